@@ -4,22 +4,202 @@
 #include <linux/cdev.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/rwsem.h>
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include "globalmem.h"
+
+#define CREATE_TRACE_POINTS
+#include "globalmem_trace.h"
 
 #define GLOBALMEM_SIZE      0x1000
-#define GLOBALMEM_MAGIC     'g'
-#define MEM_CLEAR           _IO(GLOBALMEM_MAGIC, 0)
 #define GLOBALMEM_MAJOR     230
-#define GLOBALMEM_DEV_NUM   8
+
+/* flags bits */
+#define GLOBALMEM_CLEARING  0
+
+/*
+ * read/write lock the 1 << GLOBALMEM_LOCK_SHIFT byte regions they touch.
+ * Regions are hashed onto GLOBALMEM_LOCK_STRIPES rw_semaphores, so readers
+ * share and writers of disjoint regions run in parallel. Stripes are
+ * always taken in ascending order, which keeps overlapping ranges from
+ * deadlocking; each stripe has its own lockdep class to match. Stores
+ * through mmap() do not take the locks.
+ */
+#define GLOBALMEM_LOCK_SHIFT    16
+#define GLOBALMEM_LOCK_STRIPES  16
 
 static int globalmem_major = GLOBALMEM_MAJOR;
 module_param(globalmem_major, int, S_IRUGO);
 
+/*
+ * bytes per device, rounded up to whole pages at init; pages are only
+ * allocated when first written or faulted in
+ */
+static unsigned long globalmem_size = GLOBALMEM_SIZE;
+module_param(globalmem_size, ulong, S_IRUGO);
+
+/*
+ * pages[] starts out all NULL and a slot is filled at most once, with
+ * cmpxchg(), because faults fill slots without the region locks. Only
+ * clearing empties slots again, and only while nothing is mapped;
+ * map_mutex keeps a new mapping from appearing meanwhile. It nests
+ * inside the region locks: mmap() runs under mmap_lock, which a read or
+ * write holding region locks may need to fault in its user buffer.
+ */
 struct globalmem_dev {
     struct cdev cdev;
-    unsigned char mem[GLOBALMEM_SIZE];
+    unsigned long size;
+    unsigned long nr_pages;
+    struct page **pages;
+    atomic_t nr_maps;
+    struct mutex map_mutex;
+    struct rw_semaphore locks[GLOBALMEM_LOCK_STRIPES];
+    unsigned long flags;
+    unsigned long clear_done;   /* bytes done by the background clear */
+    struct work_struct clear_work;
+    wait_queue_head_t clear_wait;
 };
 
 static struct globalmem_dev *globalmem_devp = NULL;
+static struct lock_class_key globalmem_lock_keys[GLOBALMEM_LOCK_STRIPES];
+
+/* add the stripes covering count > 0 bytes from p to mask */
+static void globalmem_lock_mask(unsigned long *mask, unsigned long p,
+    unsigned long count)
+{
+    unsigned long first = p >> GLOBALMEM_LOCK_SHIFT;
+    unsigned long last = (p + count - 1) >> GLOBALMEM_LOCK_SHIFT;
+
+    if (last - first >= GLOBALMEM_LOCK_STRIPES - 1) {
+        bitmap_fill(mask, GLOBALMEM_LOCK_STRIPES);
+        return;
+    }
+
+    for (; first <= last; first++)
+        __set_bit(first % GLOBALMEM_LOCK_STRIPES, mask);
+}
+
+static void globalmem_lock_stripes(struct globalmem_dev *dev,
+    const unsigned long *mask, bool write)
+{
+    unsigned int i = 0;
+
+    for_each_set_bit(i, mask, GLOBALMEM_LOCK_STRIPES) {
+        if (write)
+            down_write(&dev->locks[i]);
+        else
+            down_read(&dev->locks[i]);
+    }
+}
+
+static void globalmem_unlock_stripes(struct globalmem_dev *dev,
+    const unsigned long *mask, bool write)
+{
+    unsigned int i = 0;
+
+    for_each_set_bit(i, mask, GLOBALMEM_LOCK_STRIPES) {
+        if (write)
+            up_write(&dev->locks[i]);
+        else
+            up_read(&dev->locks[i]);
+    }
+}
+
+static void globalmem_lock(struct globalmem_dev *dev, unsigned long p,
+    unsigned long count, bool write)
+{
+    DECLARE_BITMAP(mask, GLOBALMEM_LOCK_STRIPES);
+
+    bitmap_zero(mask, GLOBALMEM_LOCK_STRIPES);
+    globalmem_lock_mask(mask, p, count);
+    globalmem_lock_stripes(dev, mask, write);
+}
+
+static void globalmem_unlock(struct globalmem_dev *dev, unsigned long p,
+    unsigned long count, bool write)
+{
+    DECLARE_BITMAP(mask, GLOBALMEM_LOCK_STRIPES);
+
+    bitmap_zero(mask, GLOBALMEM_LOCK_STRIPES);
+    globalmem_lock_mask(mask, p, count);
+    globalmem_unlock_stripes(dev, mask, write);
+}
+
+/* the page backing index, allocating a zeroed one if there is none */
+static struct page *globalmem_get_page(struct globalmem_dev *dev,
+    unsigned long index)
+{
+    struct page *page = READ_ONCE(dev->pages[index]);
+    struct page *old = NULL;
+
+    if (page)
+        return page;
+
+    page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!page)
+        return NULL;
+
+    /* a racing writer or fault may have got there first */
+    old = cmpxchg(&dev->pages[index], NULL, page);
+    if (old) {
+        __free_page(page);
+        return old;
+    }
+
+    return page;
+}
+
+/* untouched pages read as zeros and stay unallocated */
+static int globalmem_copy_to_iter(struct globalmem_dev *dev,
+    struct iov_iter *to, unsigned long p, size_t count)
+{
+    struct page *page = NULL;
+    size_t n = 0;
+
+    while (count) {
+        n = min_t(unsigned long, count, PAGE_SIZE - offset_in_page(p));
+        page = READ_ONCE(dev->pages[p >> PAGE_SHIFT]);
+        if (page) {
+            if (copy_to_iter(page_address(page) + offset_in_page(p), n,
+                to) != n)
+                return -EFAULT;
+        } else if (iov_iter_zero(n, to) != n) {
+            return -EFAULT;
+        }
+        p += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+static int globalmem_copy_from_iter(struct globalmem_dev *dev,
+    struct iov_iter *from, unsigned long p, size_t count)
+{
+    struct page *page = NULL;
+    size_t n = 0;
+
+    while (count) {
+        n = min_t(unsigned long, count, PAGE_SIZE - offset_in_page(p));
+        page = globalmem_get_page(dev, p >> PAGE_SHIFT);
+        if (!page)
+            return -ENOMEM;
+        if (copy_from_iter(page_address(page) + offset_in_page(p), n,
+            from) != n)
+            return -EFAULT;
+        p += n;
+        count -= n;
+    }
+
+    return 0;
+}
 
 static int globalmem_open(struct inode *inode, struct file *filp)
 {
@@ -33,110 +213,351 @@ static int globalmem_release(struct inode *inode, struct file *filp)
     return 0;
 }
 
-static ssize_t globalmem_read(struct file *filp, char __user *buf,
-    size_t size, loff_t *ppos)
+/*
+ * read/readv/preadv and io_uring all land here, so a vectored request
+ * is served in one pass however many segments it has.
+ *
+ * ki_pos is 64-bit even where unsigned long is not, so it is checked
+ * against the size before being narrowed to an offset into the pages.
+ * The VFS caps a single call at MAX_RW_COUNT bytes; count is never cut
+ * further here.
+ */
+static ssize_t globalmem_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    unsigned long p = *ppos;
-    unsigned int count = size;
-    int ret = 0;
-    struct globalmem_dev *dev = filp->private_data;
-
-    if (p >= GLOBALMEM_SIZE)
+    unsigned long p = 0;
+    size_t count = iov_iter_count(to);
+    ssize_t ret = 0;
+    struct globalmem_dev *dev = iocb->ki_filp->private_data;
+
+    if (iocb->ki_pos < 0)
+        return -EINVAL;
+    if (iocb->ki_pos >= dev->size)
         return 0;
+    p = iocb->ki_pos;
 
-    if (count > GLOBALMEM_SIZE - p)
-        count = GLOBALMEM_SIZE - p;
+    if (count > dev->size - p)
+        count = dev->size - p;
+    if (count == 0)
+        return 0;
 
-    if (copy_to_user(buf, dev->mem + p, count))
+    /* a read never sees a concurrent write to its range half done */
+    globalmem_lock(dev, p, count, false);
+    if (globalmem_copy_to_iter(dev, to, p, count))
         ret = -EFAULT;
     else {
-        *ppos += count;
+        iocb->ki_pos += count;
         ret = count;
-        printk(KERN_INFO "read globalmem %u bytes from %lu\n", count, p);
+        trace_globalmem_read(MINOR(dev->cdev.dev), p, count);
     }
+    globalmem_unlock(dev, p, count, false);
 
     return ret;
 }
 
-static ssize_t globalmem_write(struct file *filp, const char __user *buf,
-    size_t size, loff_t *ppos)
+static ssize_t globalmem_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    unsigned long p = *ppos;
-    unsigned int count = size;
-    int ret = 0;
-    struct globalmem_dev *dev = filp->private_data;
-
-    if (p >= GLOBALMEM_SIZE)
+    unsigned long p = 0;
+    size_t count = iov_iter_count(from);
+    ssize_t ret = 0;
+    struct globalmem_dev *dev = iocb->ki_filp->private_data;
+
+    if (iocb->ki_pos < 0)
+        return -EINVAL;
+    if (iocb->ki_pos >= dev->size)
         return 0;
+    p = iocb->ki_pos;
 
-    if (count > GLOBALMEM_SIZE - p)
-        count = GLOBALMEM_SIZE - p;
+    if (count > dev->size - p)
+        count = dev->size - p;
+    if (count == 0)
+        return 0;
 
-    if (copy_from_user(dev->mem + p, buf, count))
-        ret = -EFAULT;
-    else {
-        *ppos += count;
+    globalmem_lock(dev, p, count, true);
+    ret = globalmem_copy_from_iter(dev, from, p, count);
+    if (!ret) {
+        iocb->ki_pos += count;
         ret = count;
-        printk(KERN_INFO "write globalmem %u bytes to %lu\n", count, p);
+        trace_globalmem_write(MINOR(dev->cdev.dev), p, count);
     }
+    globalmem_unlock(dev, p, count, true);
 
     return ret;
 }
 
+/*
+ * Next page at or after offset that is allocated (data) or not (hole),
+ * as a byte offset; the end of the device counts as a hole.
+ */
+static loff_t globalmem_seek_page(struct globalmem_dev *dev, loff_t offset,
+    bool data)
+{
+    unsigned long i = 0;
+
+    for (i = offset >> PAGE_SHIFT; i < dev->nr_pages; i++) {
+        if (!READ_ONCE(dev->pages[i]) != data)
+            return max_t(loff_t, offset, (loff_t)i << PAGE_SHIFT);
+    }
+
+    return data ? -ENXIO : dev->size;
+}
+
+/*
+ * SEEK_DATA and SEEK_HOLE report which pages have been allocated, at
+ * page granularity. Bounds are checked before adding so a huge offset
+ * cannot overflow.
+ */
 static loff_t globalmem_llseek(struct file *filp, loff_t offset, int orig)
 {
-    loff_t ret = 0;
+    struct globalmem_dev *dev = filp->private_data;
+    loff_t size = dev->size;
+    loff_t pos = filp->f_pos;
 
     switch (orig) {
-    case 0:
-        if (offset < 0) {
-            ret = -EINVAL;
-            break;
-        }
+    case SEEK_SET:
+        break;
 
-        if (offset > GLOBALMEM_SIZE) {
-            ret = -EINVAL;
-            break;
-        }
+    case SEEK_CUR:
+        if (offset < -pos || offset > size - pos)
+            return -EINVAL;
+        offset += pos;
+        break;
 
-        filp->f_pos = offset;
-        ret = filp->f_pos;
+    case SEEK_END:
+        if (offset < -size || offset > 0)
+            return -EINVAL;
+        offset += size;
         break;
 
-    case 1:
-        if (filp->f_pos + offset > GLOBALMEM_SIZE) {
-            ret = -EINVAL;
-            break;
+    case SEEK_DATA:
+    case SEEK_HOLE:
+        if (offset < 0 || offset >= size)
+            return -ENXIO;
+        offset = globalmem_seek_page(dev, offset, orig == SEEK_DATA);
+        if (offset < 0)
+            return offset;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    return vfs_setpos(filp, offset, size);
+}
+
+/*
+ * Zero pages first to last - 1, called with their regions locked for
+ * writing. Unless the device is mapped they are given back instead.
+ */
+static void globalmem_clear_pages(struct globalmem_dev *dev,
+    unsigned long first, unsigned long last)
+{
+    struct page *page = NULL;
+    unsigned long i = 0;
+    bool mapped = false;
+
+    mutex_lock(&dev->map_mutex);
+    mapped = atomic_read(&dev->nr_maps) != 0;
+    for (i = first; i < last; i++) {
+        if (mapped) {
+            page = READ_ONCE(dev->pages[i]);
+            if (page)
+                clear_page(page_address(page));
+        } else {
+            page = xchg(&dev->pages[i], NULL);
+            if (page)
+                __free_page(page);
         }
+        cond_resched();
+    }
+    mutex_unlock(&dev->map_mutex);
+}
 
-        if (filp->f_pos + offset < 0) {
-            ret = -EINVAL;
-            break;
+/*
+ * MEM_CLEAR_ASYNC: clear one lock region at a time, so reads and writes
+ * elsewhere carry on and each only waits for the region being cleared.
+ */
+static void globalmem_clear_work(struct work_struct *work)
+{
+    struct globalmem_dev *dev = container_of(work, struct globalmem_dev,
+        clear_work);
+    unsigned long step = 1UL << GLOBALMEM_LOCK_SHIFT;
+    unsigned long p = 0;
+    unsigned long n = 0;
+
+    for (p = 0; p < dev->size; p += n) {
+        n = min(step, dev->size - p);
+        globalmem_lock(dev, p, n, true);
+        globalmem_clear_pages(dev, p >> PAGE_SHIFT, (p + n) >> PAGE_SHIFT);
+        globalmem_unlock(dev, p, n, true);
+        WRITE_ONCE(dev->clear_done, p + n);
+    }
+
+    trace_globalmem_clear(MINOR(dev->cdev.dev));
+    clear_bit_unlock(GLOBALMEM_CLEARING, &dev->flags);
+    smp_mb__after_atomic();
+    wake_up_interruptible(&dev->clear_wait);
+}
+
+static bool globalmem_range_ok(struct globalmem_dev *dev, __u64 off,
+    __u64 len)
+{
+    return len <= dev->size && off <= dev->size - len;
+}
+
+/*
+ * MEM_FILL, called with the range locked for writing. A zero fill gives
+ * whole pages back and leaves missing ones missing.
+ */
+static int globalmem_fill(struct globalmem_dev *dev, unsigned long p,
+    unsigned long len, int c)
+{
+    struct page *page = NULL;
+    unsigned long n = 0;
+
+    for (; len; p += n, len -= n) {
+        /* first, so whole pages given back below are covered too */
+        if (fatal_signal_pending(current))
+            return -EINTR;
+        cond_resched();
+
+        n = min(len, PAGE_SIZE - offset_in_page(p));
+        if (c == 0 && n == PAGE_SIZE) {
+            globalmem_clear_pages(dev, p >> PAGE_SHIFT,
+                (p >> PAGE_SHIFT) + 1);
+            continue;
         }
 
-        filp->f_pos += offset;
-        ret = filp->f_pos;
-        break;
+        if (c == 0)
+            page = READ_ONCE(dev->pages[p >> PAGE_SHIFT]);
+        else
+            page = globalmem_get_page(dev, p >> PAGE_SHIFT);
+        if (page)
+            memset(page_address(page) + offset_in_page(p), c, n);
+        else if (c != 0)
+            return -ENOMEM;
+    }
 
-    default:
-        ret = -EINVAL;
-        break;
+    return 0;
+}
+
+/*
+ * MEM_COPY, called with both ranges locked for writing. Overlapping
+ * ranges are walked from the end when dst lies above src, as memmove()
+ * does; a hole copied onto a hole stays unallocated.
+ */
+static int globalmem_copy(struct globalmem_dev *dev, unsigned long src,
+    unsigned long dst, unsigned long len)
+{
+    bool backward = dst > src && dst - src < len;
+    struct page *sp = NULL;
+    struct page *dp = NULL;
+    unsigned long s = 0;
+    unsigned long d = 0;
+    unsigned long n = 0;
+
+    while (len) {
+        if (backward) {
+            s = src + len - 1;
+            d = dst + len - 1;
+            n = min3(len, offset_in_page(s) + 1, offset_in_page(d) + 1);
+            s -= n - 1;
+            d -= n - 1;
+        } else {
+            s = src;
+            d = dst;
+            n = min3(len, PAGE_SIZE - offset_in_page(s),
+                PAGE_SIZE - offset_in_page(d));
+            src += n;
+            dst += n;
+        }
+        len -= n;
+
+        sp = READ_ONCE(dev->pages[s >> PAGE_SHIFT]);
+        dp = READ_ONCE(dev->pages[d >> PAGE_SHIFT]);
+        if (sp || dp) {
+            dp = globalmem_get_page(dev, d >> PAGE_SHIFT);
+            if (!dp)
+                return -ENOMEM;
+            if (sp)
+                memmove(page_address(dp) + offset_in_page(d),
+                    page_address(sp) + offset_in_page(s), n);
+            else
+                memset(page_address(dp) + offset_in_page(d), 0, n);
+        }
+
+        if (fatal_signal_pending(current))
+            return -EINTR;
+        cond_resched();
     }
 
-    return ret;
+    return 0;
 }
 
 static long globalmem_ioctl(struct file *filp,
     unsigned int cmd, unsigned long arg)
 {
     struct globalmem_dev *dev = filp->private_data;
+    struct globalmem_clear_status st;
+    struct globalmem_fill fill;
+    struct globalmem_copy copy;
+    DECLARE_BITMAP(mask, GLOBALMEM_LOCK_STRIPES);
+    int ret = 0;
 
     switch (cmd) {
     case MEM_CLEAR:
-        memset(dev->mem, 0, GLOBALMEM_SIZE);
-        printk(KERN_INFO "globalmem is set to zero\n");
+        globalmem_lock(dev, 0, dev->size, true);
+        globalmem_clear_pages(dev, 0, dev->nr_pages);
+        globalmem_unlock(dev, 0, dev->size, true);
+        trace_globalmem_clear(MINOR(dev->cdev.dev));
+        break;
+
+    case MEM_CLEAR_ASYNC:
+        if (test_and_set_bit_lock(GLOBALMEM_CLEARING, &dev->flags))
+            return -EBUSY;
+        WRITE_ONCE(dev->clear_done, 0);
+        queue_work(system_unbound_wq, &dev->clear_work);
+        break;
+
+    case MEM_CLEAR_STATUS:
+        memset(&st, 0, sizeof(st));
+        st.busy = test_bit(GLOBALMEM_CLEARING, &dev->flags);
+        st.done = st.busy ? READ_ONCE(dev->clear_done) : dev->size;
+        st.size = dev->size;
+        if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+            return -EFAULT;
         break;
 
+    case MEM_FILL:
+        if (copy_from_user(&fill, (void __user *)arg, sizeof(fill)))
+            return -EFAULT;
+        if (!globalmem_range_ok(dev, fill.off, fill.len))
+            return -EINVAL;
+        if (fill.len == 0)
+            break;
+
+        globalmem_lock(dev, fill.off, fill.len, true);
+        ret = globalmem_fill(dev, fill.off, fill.len, fill.value & 0xff);
+        globalmem_unlock(dev, fill.off, fill.len, true);
+        return ret;
+
+    case MEM_COPY:
+        if (copy_from_user(&copy, (void __user *)arg, sizeof(copy)))
+            return -EFAULT;
+        if (!globalmem_range_ok(dev, copy.src, copy.len) ||
+            !globalmem_range_ok(dev, copy.dst, copy.len))
+            return -EINVAL;
+        if (copy.len == 0 || copy.src == copy.dst)
+            break;
+
+        /* one set of stripes for both ranges, so they may share some */
+        bitmap_zero(mask, GLOBALMEM_LOCK_STRIPES);
+        globalmem_lock_mask(mask, copy.src, copy.len);
+        globalmem_lock_mask(mask, copy.dst, copy.len);
+        globalmem_lock_stripes(dev, mask, true);
+        ret = globalmem_copy(dev, copy.src, copy.dst, copy.len);
+        globalmem_unlock_stripes(dev, mask, true);
+        return ret;
+
     default:
         return -ENOIOCTLCMD;
     }
@@ -144,16 +565,125 @@ static long globalmem_ioctl(struct file *filp,
     return 0;
 }
 
+/* readable and writable, except while a background clear is running */
+static unsigned int globalmem_poll(struct file *filp,
+    struct poll_table_struct *wait)
+{
+    struct globalmem_dev *dev = filp->private_data;
+
+    poll_wait(filp, &dev->clear_wait, wait);
+    if (test_bit(GLOBALMEM_CLEARING, &dev->flags))
+        return 0;
+
+    return POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+}
+
+static void globalmem_vm_open(struct vm_area_struct *vma)
+{
+    struct globalmem_dev *dev = vma->vm_private_data;
+
+    atomic_inc(&dev->nr_maps);
+}
+
+static void globalmem_vm_close(struct vm_area_struct *vma)
+{
+    struct globalmem_dev *dev = vma->vm_private_data;
+
+    atomic_dec(&dev->nr_maps);
+}
+
+/*
+ * A shared mapping cannot be given the zero page, since later stores
+ * would not fault, so even a read fault allocates the page.
+ */
+static vm_fault_t globalmem_vm_fault(struct vm_fault *vmf)
+{
+    struct globalmem_dev *dev = vmf->vma->vm_private_data;
+    struct page *page = NULL;
+
+    if (vmf->pgoff >= dev->nr_pages)
+        return VM_FAULT_SIGBUS;
+
+    page = globalmem_get_page(dev, vmf->pgoff);
+    if (!page)
+        return VM_FAULT_OOM;
+
+    get_page(page);
+    vmf->page = page;
+    return 0;
+}
+
+static const struct vm_operations_struct globalmem_vm_ops = {
+    .open = globalmem_vm_open,
+    .close = globalmem_vm_close,
+    .fault = globalmem_vm_fault,
+};
+
+static int globalmem_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct globalmem_dev *dev = filp->private_data;
+
+    if (vma->vm_pgoff >= dev->nr_pages ||
+        vma_pages(vma) > dev->nr_pages - vma->vm_pgoff)
+        return -EINVAL;
+
+    /* serialises against clearing freeing pages */
+    mutex_lock(&dev->map_mutex);
+    vma->vm_ops = &globalmem_vm_ops;
+    vma->vm_private_data = dev;
+    globalmem_vm_open(vma);
+    mutex_unlock(&dev->map_mutex);
+    return 0;
+}
+
 static const struct file_operations globalmem_fops = {
     .owner = THIS_MODULE,
     .open = globalmem_open,
     .release = globalmem_release,
     .llseek = globalmem_llseek,
-    .read = globalmem_read,
-    .write = globalmem_write,
+    .read_iter = globalmem_read_iter,
+    .write_iter = globalmem_write_iter,
     .unlocked_ioctl = globalmem_ioctl,
+    .poll = globalmem_poll,
+    .mmap = globalmem_mmap,
 };
 
+static void globalmem_free_pages(struct globalmem_dev *dev)
+{
+    unsigned long i = 0;
+
+    if (!dev->pages)
+        return;
+
+    for (i = 0; i < dev->nr_pages; i++) {
+        if (dev->pages[i])
+            __free_page(dev->pages[i]);
+    }
+    kvfree(dev->pages);
+    dev->pages = NULL;
+}
+
+/* only the page table is allocated here, the pages come on demand */
+static int globalmem_alloc_pages(struct globalmem_dev *dev)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < GLOBALMEM_LOCK_STRIPES; i++)
+        __init_rwsem(&dev->locks[i], "globalmem_lock",
+            &globalmem_lock_keys[i]);
+    mutex_init(&dev->map_mutex);
+    INIT_WORK(&dev->clear_work, globalmem_clear_work);
+    init_waitqueue_head(&dev->clear_wait);
+
+    dev->size = globalmem_size;
+    dev->nr_pages = globalmem_size >> PAGE_SHIFT;
+    dev->pages = kvcalloc(dev->nr_pages, sizeof(struct page *), GFP_KERNEL);
+    if (!dev->pages)
+        return -ENOMEM;
+
+    return 0;
+}
+
 static int globalmem_setup_cdev(struct globalmem_dev *dev, int index)
 {
     int ret = 0;
@@ -174,6 +704,12 @@ static int __init globalmem_init(void)
     int i = 0;
     dev_t devno = MKDEV(globalmem_major, 0);
 
+    if (globalmem_size == 0) {
+        printk(KERN_ERR "globalmem_size must not be zero\n");
+        return -EINVAL;
+    }
+    globalmem_size = PAGE_ALIGN(globalmem_size);
+
     if (globalmem_major)
         ret = register_chrdev_region(devno, GLOBALMEM_DEV_NUM, "globalmem");
     else {
@@ -195,10 +731,18 @@ static int __init globalmem_init(void)
     }
 
     for (i = 0; i < GLOBALMEM_DEV_NUM; i++) {
+        ret = globalmem_alloc_pages(&globalmem_devp[i]);
+        if (ret) {
+            printk(KERN_ERR "Error allocating %lu bytes for globalmem%d\n",
+                globalmem_size, i);
+            goto fail_cdev;
+        }
+
         ret = globalmem_setup_cdev(&globalmem_devp[i], i);
         if (ret) {
             printk(KERN_ERR "Error %d initializing globalmem cdev %d\n",
                 ret, i);
+            globalmem_free_pages(&globalmem_devp[i]);
             goto fail_cdev;
         }
     }
@@ -212,6 +756,7 @@ fail_cdev:
     while (i > 0) {
         i--;
         cdev_del(&globalmem_devp[i].cdev);
+        globalmem_free_pages(&globalmem_devp[i]);
     }
     kfree(globalmem_devp);
 fail_malloc:
@@ -224,8 +769,11 @@ static void __exit globalmem_exit(void)
 {
     int i = 0;
 
-    for (i = 0; i < GLOBALMEM_DEV_NUM; i++)
+    for (i = 0; i < GLOBALMEM_DEV_NUM; i++) {
         cdev_del(&globalmem_devp[i].cdev);
+        cancel_work_sync(&globalmem_devp[i].clear_work);
+        globalmem_free_pages(&globalmem_devp[i]);
+    }
 
     kfree(globalmem_devp);
     globalmem_devp = NULL;
@@ -0,0 +1,59 @@
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define GLOBALMEM_DEV_NUM   8
+
+#define GLOBALMEM_MAGIC     'g'
+
+/*
+ * Zero the whole device before returning. Pages are given back to the
+ * system unless the device is mapped, in which case they are zeroed.
+ */
+#define MEM_CLEAR           _IO(GLOBALMEM_MAGIC, 0)
+
+/*
+ * Start clearing the whole device in the background and return at once,
+ * or fail with EBUSY if a background clear is already running. The
+ * device is cleared one region at a time, so reads and writes go on
+ * meanwhile; a write that lands in a region the clear has not reached
+ * yet is cleared too. poll() reports no events while the clear runs
+ * and POLLIN | POLLOUT once it is done; MEM_CLEAR_STATUS shows how far
+ * it has got.
+ */
+#define MEM_CLEAR_ASYNC     _IO(GLOBALMEM_MAGIC, 1)
+
+struct globalmem_clear_status {
+    __u64 done;         /* bytes cleared so far */
+    __u64 size;         /* device size */
+    __u32 busy;         /* a background clear is running */
+    __u32 reserved;
+};
+
+#define MEM_CLEAR_STATUS    \
+    _IOR(GLOBALMEM_MAGIC, 2, struct globalmem_clear_status)
+
+/*
+ * Set len bytes from off to the low byte of value, without passing the
+ * data through user space. Filling with zero gives whole pages back as
+ * MEM_CLEAR does.
+ */
+struct globalmem_fill {
+    __u64 off;
+    __u64 len;
+    __u32 value;
+    __u32 reserved;
+};
+
+#define MEM_FILL            _IOW(GLOBALMEM_MAGIC, 3, struct globalmem_fill)
+
+/*
+ * Copy len bytes from src to dst inside the device, as memmove() would,
+ * so the ranges may overlap.
+ */
+struct globalmem_copy {
+    __u64 src;
+    __u64 dst;
+    __u64 len;
+};
+
+#define MEM_COPY            _IOW(GLOBALMEM_MAGIC, 4, struct globalmem_copy)
@@ -0,0 +1,65 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM globalmem
+
+#if !defined(_GLOBALMEM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GLOBALMEM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(globalmem_io,
+
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count),
+
+    TP_ARGS(minor, pos, count),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+    ),
+
+    TP_printk("globalmem%u pos=%lld count=%zu",
+        __entry->minor, __entry->pos, __entry->count)
+);
+
+DEFINE_EVENT(globalmem_io, globalmem_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count),
+    TP_ARGS(minor, pos, count)
+);
+
+DEFINE_EVENT(globalmem_io, globalmem_write,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count),
+    TP_ARGS(minor, pos, count)
+);
+
+TRACE_EVENT(globalmem_clear,
+
+    TP_PROTO(unsigned int minor),
+
+    TP_ARGS(minor),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+    ),
+
+    TP_printk("globalmem%u", __entry->minor)
+);
+
+#endif /* _GLOBALMEM_TRACE_H */
+
+/* this part must be outside the header guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE globalmem_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,175 @@
+/*
+ * Scaling and torn read check for concurrent pread()/pwrite() on
+ * /dev/globalmem0, from 1 to max_threads threads.
+ *
+ * The device is cut into SLOT_LEN slots; SLOT_LEN is not a power of two,
+ * so some slots straddle the driver's lock regions. Every thread picks
+ * random slots and either pwrite()s one filled with a single 64-bit
+ * stamp or pread()s one and checks that it holds a single stamp. A read
+ * that sees two stamps caught a write half done and counts as torn.
+ *
+ * Load the module with a large globalmem_size, for example 64 MiB, so
+ * the threads mostly hit different slots.
+ *
+ * usage: bench_prw [max_threads] [seconds] [write_percent]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DEV_NAME    "/dev/globalmem0"
+#define SIZE_PARAM  "/sys/module/globalmem/parameters/globalmem_size"
+#define SLOT_LEN    (24 * 1024)
+#define MAX_THREADS 64
+
+struct worker {
+    pthread_t tid;
+    int fd;
+    unsigned int id;
+    unsigned int seed;
+    long ops;
+    long torn;
+    long errors;
+};
+
+static volatile int stop;
+static unsigned long nr_slots;
+static int write_percent = 50;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t globalmem_size(void)
+{
+    FILE *fp = NULL;
+    unsigned long size = 0;
+
+    fp = fopen(SIZE_PARAM, "r");
+    if (!fp)
+        return 4096;
+
+    if (fscanf(fp, "%lu", &size) != 1)
+        size = 4096;
+    fclose(fp);
+
+    /* the driver rounds the parameter up to whole pages */
+    return (size + 4095) & ~4095UL;
+}
+
+static void *worker(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t buf[SLOT_LEN / sizeof(uint64_t)];
+    uint64_t stamp = 0;
+    off_t off = 0;
+    size_t i = 0;
+
+    while (!stop) {
+        off = (off_t)(rand_r(&w->seed) % nr_slots) * SLOT_LEN;
+
+        if (rand_r(&w->seed) % 100 < write_percent) {
+            stamp = ((uint64_t)w->id << 48) | w->ops;
+            for (i = 0; i < SLOT_LEN / sizeof(uint64_t); i++)
+                buf[i] = stamp;
+            if (pwrite(w->fd, buf, SLOT_LEN, off) != SLOT_LEN)
+                w->errors++;
+        } else {
+            if (pread(w->fd, buf, SLOT_LEN, off) != SLOT_LEN) {
+                w->errors++;
+                continue;
+            }
+            for (i = 1; i < SLOT_LEN / sizeof(uint64_t); i++) {
+                if (buf[i] != buf[0]) {
+                    w->torn++;
+                    break;
+                }
+            }
+        }
+        w->ops++;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct worker workers[MAX_THREADS];
+    int max = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    long ops = 0;
+    long torn = 0;
+    long errors = 0;
+    double start = 0;
+    double spent = 0;
+    int fd = -1;
+    int nr = 0;
+    int i = 0;
+
+    if (argc > 3)
+        write_percent = atoi(argv[3]);
+    if (max > MAX_THREADS)
+        max = MAX_THREADS;
+    if (max < 1)
+        max = 1;
+
+    nr_slots = globalmem_size() / SLOT_LEN;
+    if (nr_slots == 0) {
+        printf("globalmem_size must be at least %d\n", SLOT_LEN);
+        return -1;
+    }
+
+    /* threads share one fd, positioned I/O never touches f_pos */
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    printf("%lu slots of %d bytes, %d%% writes\n", nr_slots, SLOT_LEN,
+        write_percent);
+    printf("%8s %12s %10s %8s %8s\n", "threads", "ops/s", "MiB/s", "torn",
+        "errors");
+
+    for (nr = 1; ; nr = nr * 2 > max ? max : nr * 2) {
+        stop = 0;
+        start = now_sec();
+        for (i = 0; i < nr; i++) {
+            memset(&workers[i], 0, sizeof(workers[i]));
+            workers[i].fd = fd;
+            workers[i].id = i + 1;
+            workers[i].seed = i * 7919 + 1;
+            pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+        }
+
+        sleep(seconds);
+        stop = 1;
+
+        ops = torn = errors = 0;
+        for (i = 0; i < nr; i++) {
+            pthread_join(workers[i].tid, NULL);
+            ops += workers[i].ops;
+            torn += workers[i].torn;
+            errors += workers[i].errors;
+        }
+        spent = now_sec() - start;
+
+        printf("%8d %12.0f %10.1f %8ld %8ld\n", nr, ops / spent,
+            ops * (double)SLOT_LEN / spent / (1024 * 1024), torn, errors);
+
+        if (nr >= max)
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Memory footprint and first-touch cost of the lazily allocated
+ * /dev/globalmem0.
+ *
+ * After MEM_CLEAR has released every page, one small pwrite() is made
+ * every stride bytes across the device, timing each one; they all hit
+ * untouched pages and so allocate. The same writes are then repeated
+ * on the now allocated pages. The allocated footprint is counted with
+ * SEEK_DATA/SEEK_HOLE and compared with the drop in MemFree, and a
+ * full read of the device shows the cost of zero-filling holes.
+ *
+ * Load the module with globalmem_size=0x40000000 for a 1 GiB device.
+ *
+ * usage: bench_sparse [stride_KiB]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "../globalmem/globalmem.h"
+
+#define DEV_NAME    "/dev/globalmem0"
+#define SIZE_PARAM  "/sys/module/globalmem/parameters/globalmem_size"
+#define READ_LEN    (1024 * 1024)
+#define KIB         1024.0
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t globalmem_size(void)
+{
+    FILE *fp = NULL;
+    unsigned long size = 0;
+
+    fp = fopen(SIZE_PARAM, "r");
+    if (!fp)
+        return 4096;
+
+    if (fscanf(fp, "%lu", &size) != 1)
+        size = 4096;
+    fclose(fp);
+
+    /* the driver rounds the parameter up to whole pages */
+    return (size + 4095) & ~4095UL;
+}
+
+static long mem_free_kib(void)
+{
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    long kib = -1;
+
+    if (!fp)
+        return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemFree: %ld kB", &kib) == 1)
+            break;
+    }
+    fclose(fp);
+    return kib;
+}
+
+/* bytes the driver has pages for, walked with SEEK_DATA/SEEK_HOLE */
+static size_t allocated(int fd, size_t size)
+{
+    size_t total = 0;
+    off_t data = 0;
+    off_t hole = 0;
+
+    for (data = lseek(fd, 0, SEEK_DATA); data >= 0 && (size_t)data < size;
+        data = lseek(fd, hole, SEEK_DATA)) {
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0)
+            break;
+        total += hole - data;
+    }
+
+    return total;
+}
+
+/* one 8-byte pwrite every stride bytes, returns the slowest in ns */
+static double touch(int fd, size_t size, size_t stride, double *avg)
+{
+    uint64_t stamp = 0x5a5a5a5a5a5a5a5aULL;
+    double worst = 0;
+    double sum = 0;
+    double t = 0;
+    size_t off = 0;
+    long n = 0;
+
+    for (off = 0; off < size; off += stride, n++) {
+        t = now_ns();
+        if (pwrite(fd, &stamp, sizeof(stamp), off) != sizeof(stamp))
+            printf("pwrite at %zu failed\n", off);
+        t = now_ns() - t;
+        sum += t;
+        if (t > worst)
+            worst = t;
+    }
+
+    *avg = n ? sum / n : 0;
+    return worst;
+}
+
+int main(int argc, char *argv[])
+{
+    static char buf[READ_LEN];
+    size_t size = globalmem_size();
+    size_t stride = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1024) * 1024;
+    long free_before = 0;
+    long free_after = 0;
+    double worst = 0;
+    double avg = 0;
+    double t = 0;
+    size_t off = 0;
+    ssize_t ret = 0;
+    int fd = -1;
+
+    if (stride == 0)
+        stride = 4096;
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    if (size < (1UL << 30))
+        printf("note: device is only %zu MiB\n", size >> 20);
+
+    t = now_ns();
+    ioctl(fd, MEM_CLEAR);
+    printf("MEM_CLEAR of %zu MiB: %.1f ms, %.0f KiB allocated after\n",
+        size >> 20, (now_ns() - t) / 1e6, allocated(fd, size) / KIB);
+
+    free_before = mem_free_kib();
+    worst = touch(fd, size, stride, &avg);
+    free_after = mem_free_kib();
+    printf("first touch every %zu KiB: avg %.0f ns, max %.0f ns\n",
+        stride >> 10, avg, worst);
+
+    worst = touch(fd, size, stride, &avg);
+    printf("rewrite of the same spots:  avg %.0f ns, max %.0f ns\n", avg,
+        worst);
+
+    printf("footprint: %.0f KiB allocated for a %zu MiB device, "
+        "MemFree down %ld KiB\n", allocated(fd, size) / KIB, size >> 20,
+        free_before - free_after);
+
+    t = now_ns();
+    for (off = 0; off < size; off += ret) {
+        ret = pread(fd, buf, sizeof(buf), off);
+        if (ret <= 0) {
+            printf("pread at %zu failed\n", off);
+            break;
+        }
+    }
+    t = now_ns() - t;
+    printf("full read: %.1f MiB/s, %.0f KiB allocated after\n",
+        (size >> 20) / (t / 1e9), allocated(fd, size) / KIB);
+
+    ioctl(fd, MEM_CLEAR);
+    close(fd);
+    return 0;
+}
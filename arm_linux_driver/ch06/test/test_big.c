@@ -0,0 +1,153 @@
+/*
+ * Large transfers and 64-bit offsets on /dev/globalmem0.
+ *
+ * Writes the whole device with as few pwrite() calls as the kernel
+ * allows, reads it back the same way and compares, printing how many
+ * bytes each call moved; Linux caps one call at MAX_RW_COUNT, just
+ * under 2 GiB. It then checks lseek() with SEEK_END, SEEK_DATA and
+ * SEEK_HOLE, and that offsets past 4 GiB neither wrap nor fail oddly.
+ *
+ * Load the module with a multi-GiB globalmem_size, for example
+ * globalmem_size=0x100000000, to exercise the large cases.
+ *
+ * usage: test_big
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define DEV_NAME    "/dev/globalmem0"
+#define SIZE_PARAM  "/sys/module/globalmem/parameters/globalmem_size"
+
+static int failures;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t globalmem_size(void)
+{
+    FILE *fp = NULL;
+    unsigned long size = 0;
+
+    fp = fopen(SIZE_PARAM, "r");
+    if (!fp)
+        return 4096;
+
+    if (fscanf(fp, "%lu", &size) != 1)
+        size = 4096;
+    fclose(fp);
+
+    /* the driver rounds the parameter up to whole pages */
+    return (size + 4095) & ~4095UL;
+}
+
+static void expect(const char *what, long long got, long long want)
+{
+    if (got == want) {
+        printf("ok    %s = %lld\n", what, got);
+        return;
+    }
+    printf("FAIL  %s = %lld, expected %lld\n", what, got, want);
+    failures++;
+}
+
+/* move size bytes at offset 0, one call per loop, reporting each call */
+static int transfer(int fd, unsigned char *buf, size_t size, int do_write)
+{
+    size_t done = 0;
+    ssize_t ret = 0;
+    double start = now_sec();
+
+    while (done < size) {
+        if (do_write)
+            ret = pwrite(fd, buf + done, size - done, done);
+        else
+            ret = pread(fd, buf + done, size - done, done);
+        if (ret <= 0) {
+            printf("FAIL  %s at %zu: %s\n", do_write ? "pwrite" : "pread",
+                done, ret ? strerror(errno) : "end of device");
+            failures++;
+            return -1;
+        }
+        printf("      %s moved %zd bytes\n", do_write ? "pwrite" : "pread",
+            ret);
+        done += ret;
+    }
+
+    printf("ok    %s of %zu bytes, %.1f MiB/s\n", do_write ? "write" : "read",
+        size, size / (now_sec() - start) / (1024 * 1024));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = globalmem_size();
+    unsigned char *wbuf = NULL;
+    unsigned char *rbuf = NULL;
+    char c = 0;
+    size_t i = 0;
+    int fd = -1;
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    /* anonymous mappings, so multi-GiB buffers only cost what is touched */
+    wbuf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    rbuf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (wbuf == MAP_FAILED || rbuf == MAP_FAILED) {
+        printf("cannot map two %zu byte buffers\n", size);
+        return -1;
+    }
+
+    printf("device size %zu bytes\n", size);
+    for (i = 0; i < size; i += sizeof(uint64_t))
+        *(uint64_t *)(wbuf + i) = i * 0x9e3779b97f4a7c15ULL;
+
+    if (transfer(fd, wbuf, size, 1) == 0 && transfer(fd, rbuf, size, 0) == 0)
+        expect("bytes differing after read back",
+            memcmp(wbuf, rbuf, size) ? 1 : 0, 0);
+
+    expect("lseek(0, SEEK_END)", lseek(fd, 0, SEEK_END), size);
+    expect("lseek(-1, SEEK_END)", lseek(fd, -1, SEEK_END), size - 1);
+    expect("lseek(1, SEEK_END)", lseek(fd, 1, SEEK_END), -1);
+    expect("lseek(0, SEEK_DATA)", lseek(fd, 0, SEEK_DATA), 0);
+    expect("lseek(0, SEEK_HOLE)", lseek(fd, 0, SEEK_HOLE), size);
+    errno = 0;
+    lseek(fd, size, SEEK_DATA);
+    expect("lseek(size, SEEK_DATA) errno", errno, ENXIO);
+    lseek(fd, 0, SEEK_SET);
+    expect("lseek(LLONG_MAX, SEEK_CUR)", lseek(fd, INT64_MAX, SEEK_CUR), -1);
+
+    /* a 32-bit offset must not alias the start of the device */
+    expect("pread at 4 GiB + 1",
+        pread(fd, &c, 1, (1ULL << 32) + 1),
+        size > (1ULL << 32) + 1 ? 1 : 0);
+    if (size > (1ULL << 32) + 1)
+        expect("byte at 4 GiB + 1", (unsigned char)c, wbuf[(1ULL << 32) + 1]);
+    expect("pread past the end", pread(fd, &c, 1, size), 0);
+    expect("pwrite past the end", pwrite(fd, &c, 1, size), 0);
+
+    munmap(wbuf, size);
+    munmap(rbuf, size);
+    close(fd);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Synchronous versus background clearing of /dev/globalmem0, and the
+ * MEM_FILL/MEM_COPY results.
+ *
+ * The device is filled with MEM_FILL, so every page is allocated, and
+ * cleared with MEM_CLEAR, timing the call. It is then filled again and
+ * cleared with MEM_CLEAR_ASYNC, timing how long the call takes to return
+ * and how long until poll() reports the clear done, while a second
+ * thread times small pread()s to show how long I/O waits meanwhile.
+ * Finally MEM_FILL and overlapping MEM_COPY results are checked against
+ * pread().
+ *
+ * Load the module with globalmem_size=0x10000000 for a 256 MiB device.
+ *
+ * usage: test_clear
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalmem/globalmem.h"
+
+#define DEV_NAME    "/dev/globalmem0"
+#define SIZE_PARAM  "/sys/module/globalmem/parameters/globalmem_size"
+#define PROBE_LEN   512
+#define CHECK_LEN   (256 * 1024)
+
+static volatile int probing;
+static int failures;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t globalmem_size(void)
+{
+    FILE *fp = NULL;
+    unsigned long size = 0;
+
+    fp = fopen(SIZE_PARAM, "r");
+    if (!fp)
+        return 4096;
+
+    if (fscanf(fp, "%lu", &size) != 1)
+        size = 4096;
+    fclose(fp);
+
+    /* the driver rounds the parameter up to whole pages */
+    return (size + 4095) & ~4095UL;
+}
+
+static void expect(const char *what, long long got, long long want)
+{
+    if (got == want) {
+        printf("ok    %s = %lld\n", what, got);
+        return;
+    }
+    printf("FAIL  %s = %lld, expected %lld\n", what, got, want);
+    failures++;
+}
+
+static int fill(int fd, size_t off, size_t len, int value)
+{
+    struct globalmem_fill f = { .off = off, .len = len, .value = value };
+
+    return ioctl(fd, MEM_FILL, &f);
+}
+
+static int copy(int fd, size_t src, size_t dst, size_t len)
+{
+    struct globalmem_copy c = { .src = src, .dst = dst, .len = len };
+
+    return ioctl(fd, MEM_COPY, &c);
+}
+
+struct probe {
+    int fd;
+    size_t size;
+    long n;
+    double worst;
+};
+
+/* small reads spread over the device until told to stop */
+static void *prober(void *arg)
+{
+    struct probe *pr = arg;
+    char buf[PROBE_LEN];
+    unsigned int seed = 1;
+    double t = 0;
+
+    while (probing) {
+        t = now_ns();
+        pread(pr->fd, buf, sizeof(buf),
+            (rand_r(&seed) % (pr->size / PROBE_LEN)) * PROBE_LEN);
+        t = now_ns() - t;
+        if (t > pr->worst)
+            pr->worst = t;
+        pr->n++;
+    }
+
+    return NULL;
+}
+
+static void time_clears(int fd, size_t size)
+{
+    struct globalmem_clear_status st;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct probe pr = { .size = size };
+    pthread_t tid;
+    double t = 0;
+    double ret_ns = 0;
+    int samples = 0;
+
+    if (fill(fd, 0, size, 0xff))
+        printf("MEM_FILL failed: %s\n", strerror(errno));
+    t = now_ns();
+    ioctl(fd, MEM_CLEAR);
+    printf("MEM_CLEAR of %zu MiB:       %10.2f ms in the call\n",
+        size >> 20, (now_ns() - t) / 1e6);
+
+    fill(fd, 0, size, 0xff);
+    pr.fd = open(DEV_NAME, O_RDONLY);
+    probing = 1;
+    pthread_create(&tid, NULL, prober, &pr);
+
+    t = now_ns();
+    if (ioctl(fd, MEM_CLEAR_ASYNC)) {
+        printf("MEM_CLEAR_ASYNC failed: %s\n", strerror(errno));
+        failures++;
+    }
+    ret_ns = now_ns() - t;
+    expect("second MEM_CLEAR_ASYNC errno",
+        ioctl(fd, MEM_CLEAR_ASYNC) ? errno : 0, EBUSY);
+
+    /* wake every millisecond to sample the progress */
+    while (poll(&pfd, 1, 1) == 0) {
+        if (ioctl(fd, MEM_CLEAR_STATUS, &st) == 0 && st.busy)
+            samples++;
+    }
+    t = now_ns() - t;
+
+    probing = 0;
+    pthread_join(tid, NULL);
+    close(pr.fd);
+
+    printf("MEM_CLEAR_ASYNC of %zu MiB: %10.2f ms in the call, "
+        "%.2f ms until poll() (%d progress samples)\n", size >> 20,
+        ret_ns / 1e6, t / 1e6, samples);
+    printf("%ld %d byte preads meanwhile, slowest %.1f us\n", pr.n,
+        PROBE_LEN, pr.worst / 1e3);
+
+    ioctl(fd, MEM_CLEAR_STATUS, &st);
+    expect("status done after poll()", st.done, size);
+    expect("status busy after poll()", st.busy, 0);
+}
+
+/* count of bytes in [off, off + len) that differ from want */
+static long differ(int fd, size_t off, size_t len, const unsigned char *want)
+{
+    static unsigned char buf[CHECK_LEN];
+    long bad = 0;
+    size_t i = 0;
+
+    if (pread(fd, buf, len, off) != (ssize_t)len)
+        return -1;
+    for (i = 0; i < len; i++)
+        bad += buf[i] != want[i];
+    return bad;
+}
+
+static void check_fill_copy(int fd, size_t size)
+{
+    static unsigned char want[CHECK_LEN];
+    size_t i = 0;
+
+    ioctl(fd, MEM_CLEAR);
+
+    /* unaligned fill over a page boundary, then zero its middle */
+    memset(want, 0, sizeof(want));
+    expect("MEM_FILL 0xab", fill(fd, 100, 10000, 0x1ab), 0);
+    memset(want + 100, 0xab, 10000);
+    expect("MEM_FILL 0 of a whole page", fill(fd, 4096, 4096, 0), 0);
+    memset(want + 4096, 0, 4096);
+    expect("bytes differing after MEM_FILL",
+        differ(fd, 0, CHECK_LEN, want), 0);
+    expect("lseek(4096, SEEK_DATA) after a zero fill",
+        lseek(fd, 4096, SEEK_DATA), 8192);
+
+    /* a pattern, then copies overlapping forwards and backwards */
+    for (i = 0; i < CHECK_LEN; i++)
+        want[i] = i * 7 + (i >> 9);
+    pwrite(fd, want, CHECK_LEN, 0);
+    expect("MEM_COPY up by 1000", copy(fd, 0, 1000, 50000), 0);
+    memmove(want + 1000, want, 50000);
+    expect("MEM_COPY down by 333", copy(fd, 70000, 69667, 60000), 0);
+    memmove(want + 69667, want + 70000, 60000);
+    expect("bytes differing after MEM_COPY",
+        differ(fd, 0, CHECK_LEN, want), 0);
+
+    /* copying a hole over data zeroes it */
+    expect("MEM_COPY from a hole", copy(fd, size - 8192, 4096, 8192), 0);
+    memset(want + 4096, 0, 8192);
+    expect("bytes differing after copying a hole",
+        differ(fd, 0, CHECK_LEN, want), 0);
+
+    errno = 0;
+    copy(fd, 0, size - 4095, 4096);
+    expect("MEM_COPY past the end errno", errno, EINVAL);
+    errno = 0;
+    fill(fd, size, 1, 0);
+    expect("MEM_FILL past the end errno", errno, EINVAL);
+
+    ioctl(fd, MEM_CLEAR);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = globalmem_size();
+    int fd = -1;
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    if (size < (256UL << 20))
+        printf("note: device is only %zu KiB\n", size >> 10);
+    if (size < 2 * CHECK_LEN) {
+        printf("globalmem_size must be at least %d\n", 2 * CHECK_LEN);
+        return -1;
+    }
+
+    time_clears(fd, size);
+    check_fill_copy(fd, size);
+
+    close(fd);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Write and read many small segments of /dev/globalmem0 with one
+ * pwritev()/preadv(), check the data, and compare the cost with one
+ * pwrite()/pread() per segment.
+ *
+ * usage: test_iov [segments] [seg_len] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define DEV_NAME    "/dev/globalmem0"
+#define MAX_SEGS    1024
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int one_round(int fd, struct iovec *wv, struct iovec *rv, int segs,
+    int vectored, long *syscalls)
+{
+    int i = 0;
+    off_t off = 0;
+    ssize_t total = 0;
+
+    for (i = 0; i < segs; i++)
+        total += wv[i].iov_len;
+
+    if (vectored) {
+        if (pwritev(fd, wv, segs, 0) != total)
+            return -1;
+        if (preadv(fd, rv, segs, 0) != total)
+            return -1;
+        *syscalls += 2;
+        return 0;
+    }
+
+    for (i = 0, off = 0; i < segs; off += wv[i].iov_len, i++) {
+        if (pwrite(fd, wv[i].iov_base, wv[i].iov_len, off) !=
+            (ssize_t)wv[i].iov_len)
+            return -1;
+    }
+    for (i = 0, off = 0; i < segs; off += rv[i].iov_len, i++) {
+        if (pread(fd, rv[i].iov_base, rv[i].iov_len, off) !=
+            (ssize_t)rv[i].iov_len)
+            return -1;
+    }
+    *syscalls += 2 * segs;
+    return 0;
+}
+
+static int run(int fd, int segs, int seg_len, int rounds, int vectored)
+{
+    static struct iovec wv[MAX_SEGS];
+    static struct iovec rv[MAX_SEGS];
+    char *wbuf = malloc(segs * seg_len);
+    char *rbuf = malloc(segs * seg_len);
+    long syscalls = 0;
+    double start = 0;
+    double spent = 0;
+    int i = 0;
+    int ret = -1;
+
+    if (!wbuf || !rbuf)
+        goto out;
+
+    for (i = 0; i < segs * seg_len; i++)
+        wbuf[i] = (char)(i * 13 + vectored);
+
+    for (i = 0; i < segs; i++) {
+        wv[i].iov_base = wbuf + i * seg_len;
+        wv[i].iov_len = seg_len;
+        rv[i].iov_base = rbuf + i * seg_len;
+        rv[i].iov_len = seg_len;
+    }
+
+    start = now_sec();
+    for (i = 0; i < rounds; i++) {
+        if (one_round(fd, wv, rv, segs, vectored, &syscalls)) {
+            printf("%s round %d failed\n", vectored ? "preadv/pwritev" :
+                "pread/pwrite", i);
+            goto out;
+        }
+    }
+    spent = now_sec() - start;
+
+    if (memcmp(wbuf, rbuf, segs * seg_len)) {
+        printf("data mismatch\n");
+        goto out;
+    }
+
+    printf("%-15s %8.1f syscalls/round %10.0f ns/round\n",
+        vectored ? "preadv/pwritev" : "pread/pwrite",
+        (double)syscalls / rounds, spent * 1e9 / rounds);
+    ret = 0;
+
+out:
+    free(wbuf);
+    free(rbuf);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int segs = argc > 1 ? atoi(argv[1]) : 256;
+    int seg_len = argc > 2 ? atoi(argv[2]) : 16;
+    int rounds = argc > 3 ? atoi(argv[3]) : 10000;
+    int ret = 0;
+
+    if (segs > MAX_SEGS)
+        segs = MAX_SEGS;
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    printf("%d segments of %d bytes, %d rounds\n", segs, seg_len, rounds);
+
+    ret = run(fd, segs, seg_len, rounds, 0);
+    if (ret == 0)
+        ret = run(fd, segs, seg_len, rounds, 1);
+
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,204 @@
+/*
+ * Map /dev/globalmem0 from two processes, check that they share the
+ * memory, then compare mmap bandwidth with read()/write().
+ *
+ * usage: test_mmap [rounds] [io_chunk]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define DEV_NAME    "/dev/globalmem0"
+#define SIZE_PARAM  "/sys/module/globalmem/parameters/globalmem_size"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t globalmem_size(void)
+{
+    FILE *fp = NULL;
+    unsigned long size = 0;
+
+    fp = fopen(SIZE_PARAM, "r");
+    if (!fp)
+        return 4096;
+
+    if (fscanf(fp, "%lu", &size) != 1)
+        size = 4096;
+    fclose(fp);
+
+    /* the driver rounds the parameter up to whole pages */
+    return (size + 4095) & ~4095UL;
+}
+
+static int child_fill(size_t size)
+{
+    int fd = -1;
+    size_t i = 0;
+    unsigned char *mem = NULL;
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0)
+        return 1;
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return 1;
+
+    for (i = 0; i < size; i++)
+        mem[i] = (unsigned char)(i ^ 0x5a);
+
+    munmap(mem, size);
+    return 0;
+}
+
+static int check_shared(unsigned char *mem, size_t size)
+{
+    pid_t pid = 0;
+    int status = 0;
+    size_t i = 0;
+
+    memset(mem, 0, size);
+
+    pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        return -1;
+    }
+    if (pid == 0)
+        exit(child_fill(size));
+
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("child failed to map %s\n", DEV_NAME);
+        return -1;
+    }
+
+    for (i = 0; i < size; i++) {
+        if (mem[i] != (unsigned char)(i ^ 0x5a)) {
+            printf("mismatch at offset %zu: 0x%02x\n", i, mem[i]);
+            return -1;
+        }
+    }
+
+    printf("shared mapping ok: %zu bytes written by child seen by parent\n",
+        size);
+    return 0;
+}
+
+static void report(const char *what, size_t bytes, double spent)
+{
+    printf("%-14s %10.1f MiB/s\n", what, bytes / spent / (1024 * 1024));
+}
+
+static int rw_all(int fd, char *buf, size_t size, size_t chunk, int do_write)
+{
+    size_t done = 0;
+    size_t n = 0;
+    ssize_t ret = 0;
+
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        return -1;
+
+    while (done < size) {
+        n = size - done < chunk ? size - done : chunk;
+        if (do_write)
+            ret = write(fd, buf + done, n);
+        else
+            ret = read(fd, buf + done, n);
+        if (ret <= 0)
+            return -1;
+        done += ret;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int i = 0;
+    int rounds = 20;
+    size_t chunk = 4096;
+    size_t size = globalmem_size();
+    unsigned char *mem = NULL;
+    char *buf = NULL;
+    double start = 0;
+    int ret = -1;
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+    if (argc > 2)
+        chunk = strtoul(argv[2], NULL, 0);
+
+    fd = open(DEV_NAME, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        printf("mmap %s (%zu bytes) failed\n", DEV_NAME, size);
+        goto exit;
+    }
+
+    buf = malloc(size);
+    if (!buf)
+        goto exit;
+    memset(buf, 0x33, size);
+
+    if (check_shared(mem, size))
+        goto exit;
+
+    printf("\n%zu bytes x %d rounds, read()/write() chunk %zu\n",
+        size, rounds, chunk);
+
+    start = now_sec();
+    for (i = 0; i < rounds; i++)
+        memcpy(mem, buf, size);
+    report("mmap write", size * rounds, now_sec() - start);
+
+    start = now_sec();
+    for (i = 0; i < rounds; i++)
+        memcpy(buf, mem, size);
+    report("mmap read", size * rounds, now_sec() - start);
+
+    start = now_sec();
+    for (i = 0; i < rounds; i++) {
+        if (rw_all(fd, buf, size, chunk, 1)) {
+            printf("write %s failed\n", DEV_NAME);
+            goto exit;
+        }
+    }
+    report("write()", size * rounds, now_sec() - start);
+
+    start = now_sec();
+    for (i = 0; i < rounds; i++) {
+        if (rw_all(fd, buf, size, chunk, 0)) {
+            printf("read %s failed\n", DEV_NAME);
+            goto exit;
+        }
+    }
+    report("read()", size * rounds, now_sec() - start);
+
+    ret = 0;
+
+exit:
+    free(buf);
+    if (mem && mem != MAP_FAILED)
+        munmap(mem, size);
+    close(fd);
+    return ret;
+}
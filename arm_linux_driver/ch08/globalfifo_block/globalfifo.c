@@ -9,6 +9,9 @@
 #include <linux/wait.h>
 #include <linux/poll.h>
 
+#define CREATE_TRACE_POINTS
+#include "globalfifo_trace.h"
+
 #define GLOBALFIFO_SIZE      0x1000
 #define FIFO_CLEAR           0x1
 #define GLOBALFIFO_MAJOR     230
@@ -18,7 +21,8 @@ module_param(globalfifo_major, int, S_IRUGO);
 
 struct globalfifo_dev {
     struct cdev cdev;
-    unsigned int current_len;
+    unsigned int head;
+    unsigned int tail;
     unsigned char fifo[GLOBALFIFO_SIZE];
     struct mutex mutex;
     wait_queue_head_t r_wait;
@@ -27,6 +31,43 @@ struct globalfifo_dev {
 
 struct globalfifo_dev *globalfifo_devp;
 
+/*
+ * head and tail run freely and are only masked when indexing fifo[],
+ * so GLOBALFIFO_SIZE must be a power of two.
+ */
+static inline unsigned int globalfifo_len(struct globalfifo_dev *dev)
+{
+    return dev->head - dev->tail;
+}
+
+static int globalfifo_copy_to_user(struct globalfifo_dev *dev,
+    char __user *buf, size_t size)
+{
+    unsigned int off = dev->tail & (GLOBALFIFO_SIZE - 1);
+    size_t n = min_t(size_t, size, GLOBALFIFO_SIZE - off);
+
+    if (copy_to_user(buf, dev->fifo + off, n))
+        return -EFAULT;
+    if (copy_to_user(buf + n, dev->fifo, size - n))
+        return -EFAULT;
+
+    return 0;
+}
+
+static int globalfifo_copy_from_user(struct globalfifo_dev *dev,
+    const char __user *buf, size_t size)
+{
+    unsigned int off = dev->head & (GLOBALFIFO_SIZE - 1);
+    size_t n = min_t(size_t, size, GLOBALFIFO_SIZE - off);
+
+    if (copy_from_user(dev->fifo + off, buf, n))
+        return -EFAULT;
+    if (copy_from_user(dev->fifo, buf + n, size - n))
+        return -EFAULT;
+
+    return 0;
+}
+
 static int globalfifo_open(struct inode *inode, struct file *filp)
 {
     filp->private_data = globalfifo_devp;
@@ -47,9 +88,10 @@ static long globalfifo_ioctl(struct file *filp,
     case FIFO_CLEAR:
         mutex_lock(&dev->mutex);
         memset(dev->fifo, 0, GLOBALFIFO_SIZE);
-        dev->current_len = 0;
+        dev->head = 0;
+        dev->tail = 0;
         mutex_unlock(&dev->mutex);
-        printk(KERN_INFO "globalfifo is set to zero\n");
+        trace_globalfifo_clear(MINOR(dev->cdev.dev));
         break;
 
     default:
@@ -70,11 +112,11 @@ static unsigned int globalfifo_poll(struct file *filp,
     poll_wait(filp, &dev->r_wait, wait);
     poll_wait(filp, &dev->w_wait, wait);
 
-    if (dev->current_len != 0) {
+    if (globalfifo_len(dev) != 0) {
         mask |= POLLIN | POLLRDNORM;
     }
 
-    if (dev->current_len != GLOBALFIFO_SIZE) {
+    if (globalfifo_len(dev) != GLOBALFIFO_SIZE) {
         mask |= POLLOUT | POLLWRNORM;
     }
 
@@ -90,13 +132,15 @@ static ssize_t globalfifo_read(struct file *filp,
 
     mutex_lock(&dev->mutex);
 
-    while (dev->current_len == 0) {
+    while (globalfifo_len(dev) == 0) {
         if (filp->f_flags & O_NONBLOCK) {
             ret = -EAGAIN;
             goto exit1;
         } else {
             mutex_unlock(&dev->mutex);
-            ret = wait_event_interruptible(dev->r_wait, (dev->current_len > 0));
+            trace_globalfifo_wait(MINOR(dev->cdev.dev), false);
+            ret = wait_event_interruptible(dev->r_wait,
+                (globalfifo_len(dev) > 0));
             if (ret == 0) {
                 mutex_lock(&dev->mutex);
             } else {
@@ -107,18 +151,17 @@ static ssize_t globalfifo_read(struct file *filp,
         }
     }
 
-    if (size > dev->current_len) {
-        size = dev->current_len;
+    if (size > globalfifo_len(dev)) {
+        size = globalfifo_len(dev);
     }
 
-    if (copy_to_user(buf, dev->fifo, size)) {
+    if (globalfifo_copy_to_user(dev, buf, size)) {
         printk(KERN_ERR "globalfifo copy driver data to user buffer failed\n");
         ret = -EFAULT;
     } else {
-        memcpy(dev->fifo, dev->fifo + size, dev->current_len - size);
-        dev->current_len -= size;
-        printk(KERN_INFO "globalfifo read %lu bytes, current_len: %u\n",
-            size, dev->current_len);
+        dev->tail += size;
+        trace_globalfifo_read(MINOR(dev->cdev.dev), size, globalfifo_len(dev));
+        trace_globalfifo_wakeup(MINOR(dev->cdev.dev), true);
         wake_up_interruptible(&dev->w_wait);
         ret = size;
     }
@@ -137,14 +180,15 @@ static ssize_t globalfifo_write(struct file *filp,
 
     mutex_lock(&dev->mutex);
 
-    while (dev->current_len == GLOBALFIFO_SIZE) {
+    while (globalfifo_len(dev) == GLOBALFIFO_SIZE) {
         if (filp->f_flags & O_NONBLOCK) {
             ret = -EAGAIN;
             goto exit1;
         } else {
             mutex_unlock(&dev->mutex);
+            trace_globalfifo_wait(MINOR(dev->cdev.dev), true);
             ret = wait_event_interruptible(dev->w_wait,
-                (dev->current_len < GLOBALFIFO_SIZE));
+                (globalfifo_len(dev) < GLOBALFIFO_SIZE));
             if (ret == 0) {
                 mutex_lock(&dev->mutex);
             } else {
@@ -155,17 +199,17 @@ static ssize_t globalfifo_write(struct file *filp,
         }
     }
 
-    if (size > GLOBALFIFO_SIZE - dev->current_len) {
-        size = GLOBALFIFO_SIZE - dev->current_len;
+    if (size > GLOBALFIFO_SIZE - globalfifo_len(dev)) {
+        size = GLOBALFIFO_SIZE - globalfifo_len(dev);
     }
 
-    if (copy_from_user(dev->fifo + dev->current_len, buf, size)) {
+    if (globalfifo_copy_from_user(dev, buf, size)) {
         printk(KERN_ERR "globalfifo copy user data to driver buffer failed\n");
         ret = -EFAULT;
     } else {
-        dev->current_len += size;
-        printk(KERN_INFO "globalfifo write %lu bytes, current_len: %u\n",
-            size, dev->current_len);
+        dev->head += size;
+        trace_globalfifo_write(MINOR(dev->cdev.dev), size, globalfifo_len(dev));
+        trace_globalfifo_wakeup(MINOR(dev->cdev.dev), false);
         wake_up_interruptible(&dev->r_wait);
         ret = size;
     }
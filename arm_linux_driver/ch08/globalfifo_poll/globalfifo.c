@@ -5,253 +5,2631 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
 #include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/version.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/smp.h>
+#include <linux/atomic.h>
+#include <linux/eventfd.h>
+#include <linux/rcupdate.h>
+#include <linux/xarray.h>
+#include <linux/kref.h>
+#include <linux/device.h>
 #include "globalfifo.h"
 
+#define CREATE_TRACE_POINTS
+#include "globalfifo_trace.h"
+
 #define GLOBALFIFO_MAJOR    230
 
-#define GLOBALFIFO_SIZE     4096
+#define GLOBALFIFO_SIZE     4096
+
+#define GLOBALFIFO_MAX_DEVS 256
+
+/* the last minor is /dev/globalfifo_ctl, the FIFOs get the rest */
+#define GLOBALFIFO_CTL_MINOR    (GLOBALFIFO_MAX_MINORS - 1)
+
+static int globalfifo_major = GLOBALFIFO_MAJOR;
+module_param(globalfifo_major, int, S_IRUGO);
+
+/* number of devices created at load, at most GLOBALFIFO_MAX_DEVS */
+static unsigned int globalfifo_nr_devs = GLOBALFIFO_DEV_NUM;
+module_param(globalfifo_nr_devs, uint, S_IRUGO);
+
+/* per-device capacity in bytes, 0 means GLOBALFIFO_SIZE */
+static unsigned int globalfifo_size[GLOBALFIFO_MAX_DEVS];
+module_param_array(globalfifo_size, uint, NULL, S_IRUGO);
+
+/* initial wakeup watermarks of every device, see struct globalfifo_wmark */
+static unsigned int globalfifo_low_wmark = GLOBALFIFO_MAX_SIZE;
+module_param(globalfifo_low_wmark, uint, S_IRUGO);
+static unsigned int globalfifo_high_wmark = 1;
+module_param(globalfifo_high_wmark, uint, S_IRUGO);
+static unsigned int globalfifo_wmark_timeout_ms;
+module_param(globalfifo_wmark_timeout_ms, uint, S_IRUGO);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
+#define ITER_DEST   READ
+#define ITER_SOURCE WRITE
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete_sync del_timer_sync
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+#define eventfd_signal(ctx) eventfd_signal((ctx), 1)
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define timer_container_of from_timer
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+#define globalfifo_class_create(name)   class_create(THIS_MODULE, name)
+#else
+#define globalfifo_class_create(name)   class_create(name)
+#endif
+
+/*
+ * A per-CPU sub-ring of a sharded device. Writers on the shard are
+ * serialised by lock; the reader is serialised by the device's rd_mutex
+ * and synchronises with writers through head/tail alone.
+ */
+struct globalfifo_shard {
+    struct mutex lock;
+    unsigned char *buf;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int off;   /* bytes of the chunk at tail already read */
+} ____cacheline_aligned_in_smp;
+
+/* every write to a shard is stored as this header plus the payload */
+struct globalfifo_chunk {
+    u32 len;
+    u32 reserved;
+    u64 seq;
+};
+
+/*
+ * Each device holds a reference for being registered and one for every
+ * open file, so a destroyed device lives on until its last close. The
+ * structure itself is freed after an RCU grace period, as lookups by
+ * minor take their reference under rcu_read_lock().
+ */
+struct globalfifo_dev {
+    struct cdev *cdev;
+    unsigned int minor;
+    struct kref kref;
+    struct rcu_head rcu;
+    struct dentry *debugfs;
+    struct globalfifo_ring_ctrl *ctrl;
+    unsigned char *fifo;
+    unsigned int size;
+    atomic_t nr_maps;
+    /*
+     * Keeps a mapping from appearing while the buffer is swapped or the
+     * mode goes broadcast. mmap() runs under mmap_lock, which readers
+     * and writers may need to fault in their user buffers while holding
+     * the locks below, so it takes map_mutex alone; everyone else takes
+     * it innermost and never holds it across a user copy.
+     */
+    struct mutex map_mutex;
+    struct mutex mutex;     /* opens, mode and the buffer itself */
+    /*
+     * Outside SPSC mode readers, who own tail, serialise on rd_mutex and
+     * writers, who own head, on wr_mutex, so a reader and a writer copy
+     * at the same time. Nesting order: mutex, rd_mutex, wr_mutex,
+     * shard_rwsem, map_mutex.
+     */
+    struct mutex rd_mutex ____cacheline_aligned_in_smp;
+    struct mutex wr_mutex ____cacheline_aligned_in_smp;
+    wait_queue_head_t r_wait;
+    wait_queue_head_t w_wait;
+    unsigned int mode;
+    unsigned int nr_opens;
+    unsigned int nr_readers;
+    unsigned int nr_writers;
+    struct globalfifo_stats __percpu *stats;
+    unsigned int high_water;
+    unsigned int low_wmark;
+    unsigned int high_wmark;
+    unsigned int wmark_timeout_ms;
+    unsigned long rd_deadline;
+    struct timer_list rd_timer;
+    struct globalfifo_shard *shards;
+    struct rw_semaphore shard_rwsem;    /* sharded writers vs set_mode */
+    struct globalfifo_shard *shard_part;
+    unsigned int shard_size;
+    unsigned int shard_rr;
+    atomic64_t seq;
+    u64 next_seq;
+    struct eventfd_ctx __rcu *eventfd;
+    struct file *eventfd_filp;  /* the file that attached it */
+    struct list_head subs;      /* broadcast subscribers, under rd_mutex */
+    unsigned int nr_subs;
+    /*
+     * Bit 0 is set while the FIFO may hold data. Writers set it and
+     * signal the eventfd when they are the ones to do so; a reader that
+     * leaves the FIFO empty clears it again.
+     */
+    unsigned long ready;
+};
+
+/*
+ * What an open file's private_data points to. A readable file on a
+ * broadcast device is a subscriber with its own read position; the
+ * slowest one's position is the ring's tail unless the device overruns
+ * slow subscribers instead of waiting for them.
+ */
+struct globalfifo_file {
+    struct globalfifo_dev *dev;
+    struct list_head node;
+    unsigned int pos;
+};
+
+static inline struct globalfifo_dev *globalfifo_file_dev(struct file *filp)
+{
+    struct globalfifo_file *f = filp->private_data;
+
+    return f->dev;
+}
+
+/*
+ * Devices by minor. GLOBALFIFO_READY mirrors each device's ready bit,
+ * changed along with it under the xarray lock, so GET_READY only visits
+ * devices holding data. A destroyed device still open keeps its bit but
+ * leaves the mark alone, as its minor may already be reused.
+ * globalfifo_devs_mutex serialises creating and destroying devices.
+ */
+#define GLOBALFIFO_READY    XA_MARK_1
+
+static DEFINE_XARRAY_ALLOC(globalfifo_devs);
+static DEFINE_MUTEX(globalfifo_devs_mutex);
+static struct class *globalfifo_class;
+static struct cdev globalfifo_ctl_cdev;
+static struct dentry *globalfifo_debugfs;
+static struct kobject *globalfifo_kobj;
+
+/*
+ * head and tail live in the control page and run freely; they are only
+ * masked when indexing fifo[], so size is always a power of two. tail
+ * can be written by a user-space consumer through mmap, so never trust
+ * it to describe more than size bytes.
+ */
+static inline unsigned int globalfifo_len(struct globalfifo_dev *dev)
+{
+    unsigned int len = smp_load_acquire(&dev->ctrl->head) -
+        smp_load_acquire(&dev->ctrl->tail);
+
+    return min_t(unsigned int, len, READ_ONCE(dev->size));
+}
+
+/* watermarks are clamped here so they stay meaningful across a resize */
+static inline unsigned int globalfifo_low(struct globalfifo_dev *dev)
+{
+    return min(READ_ONCE(dev->low_wmark), READ_ONCE(dev->size) - 1);
+}
+
+static inline unsigned int globalfifo_high(struct globalfifo_dev *dev)
+{
+    return min(READ_ONCE(dev->high_wmark), READ_ONCE(dev->size));
+}
+
+/*
+ * Wait condition for blocked readers and POLLIN: data has reached the
+ * high watermark, or has been sitting below it past the timeout.
+ */
+static bool globalfifo_readable(struct globalfifo_dev *dev)
+{
+    unsigned int len = globalfifo_len(dev);
+
+    if (len == 0)
+        return false;
+    if (len >= globalfifo_high(dev))
+        return true;
+
+    return READ_ONCE(dev->wmark_timeout_ms) &&
+        time_after_eq(jiffies, READ_ONCE(dev->rd_deadline));
+}
+
+/*
+ * Wait condition for blocked writers: flag the sleeper to a mapping
+ * consumer before rechecking for space, so a consumer that frees space
+ * without entering the driver knows to issue GLOBALFIFO_IOC_RING_WAKE.
+ */
+static bool globalfifo_writable(struct globalfifo_dev *dev, size_t need)
+{
+    unsigned int len = 0;
+
+    WRITE_ONCE(dev->ctrl->writer_waiting, 1);
+    smp_mb();
+    len = globalfifo_len(dev);
+    return len <= globalfifo_low(dev) && READ_ONCE(dev->size) - len >= need;
+}
+
+/*
+ * Blocked readers and writers wait exclusively, so a wakeup reaches one
+ * of them instead of the whole queue. Wakeups are keyed with the poll
+ * events they stand for: an epoll entry only sees the direction it asked
+ * for, and EPOLLEXCLUSIVE entries are woken one at a time as well.
+ */
+static void globalfifo_wake_r(struct globalfifo_dev *dev)
+{
+    trace_globalfifo_wakeup(dev->minor, false);
+    wake_up_interruptible_poll(&dev->r_wait, EPOLLIN | EPOLLRDNORM);
+}
+
+static void globalfifo_wake_w(struct globalfifo_dev *dev)
+{
+    trace_globalfifo_wakeup(dev->minor, true);
+    wake_up_interruptible_poll(&dev->w_wait, EPOLLOUT | EPOLLWRNORM);
+}
+
+/* called after publishing data, signals the eventfd on the empty edge */
+static void globalfifo_mark_ready(struct globalfifo_dev *dev)
+{
+    struct eventfd_ctx *ctx = NULL;
+    bool edge = false;
+
+    /* pairs with smp_mb() in globalfifo_mark_empty() */
+    smp_mb();
+    if (test_bit(0, &dev->ready))
+        return;
+
+    xa_lock(&globalfifo_devs);
+    edge = !test_and_set_bit(0, &dev->ready);
+    if (edge && xa_load(&globalfifo_devs, dev->minor) == dev)
+        __xa_set_mark(&globalfifo_devs, dev->minor, GLOBALFIFO_READY);
+    xa_unlock(&globalfifo_devs);
+    if (!edge)
+        return;
+
+    rcu_read_lock();
+    ctx = rcu_dereference(dev->eventfd);
+    if (ctx)
+        eventfd_signal(ctx);
+    rcu_read_unlock();
+}
+
+/*
+ * Called after new data is published from old_head on. The first write
+ * into an empty FIFO starts the timeout, and sleeping readers are only
+ * woken by the write that takes the fill level up to the high watermark;
+ * before that nothing a sleeper waits for has changed.
+ *
+ * The level before the write is worked out from the level after it, so
+ * a consumer that drained the FIFO meanwhile is seen as having done so.
+ */
+static void globalfifo_wake_readers(struct globalfifo_dev *dev,
+    unsigned int old_head)
+{
+    unsigned int timeout = READ_ONCE(dev->wmark_timeout_ms);
+    unsigned int high = globalfifo_high(dev);
+    unsigned int added = dev->ctrl->head - old_head;
+    unsigned int len = globalfifo_len(dev);
+    unsigned int before = len > added ? len - added : 0;
+    unsigned long deadline = 0;
+
+    if (added)
+        globalfifo_mark_ready(dev);
+
+    if (before == 0 && timeout) {
+        deadline = jiffies + msecs_to_jiffies(timeout);
+        WRITE_ONCE(dev->rd_deadline, deadline);
+        mod_timer(&dev->rd_timer, deadline);
+    }
+
+    if (before < high && len >= high && wq_has_sleeper(&dev->r_wait))
+        globalfifo_wake_r(dev);
+}
+
+/* called after data is consumed, wakes a writer at the low watermark */
+static void globalfifo_wake_writers(struct globalfifo_dev *dev)
+{
+    if (globalfifo_len(dev) <= globalfifo_low(dev) &&
+        wq_has_sleeper(&dev->w_wait))
+        globalfifo_wake_w(dev);
+}
+
+/*
+ * An exclusive waiter that leaves data (or space) behind passes the
+ * wakeup on to the next sleeper on its side, which would otherwise
+ * wait for a state change that has already happened.
+ */
+static void globalfifo_pass_on_read(struct globalfifo_dev *dev)
+{
+    if (globalfifo_readable(dev) && wq_has_sleeper(&dev->r_wait))
+        globalfifo_wake_r(dev);
+}
+
+static void globalfifo_pass_on_write(struct globalfifo_dev *dev)
+{
+    unsigned int len = globalfifo_len(dev);
+
+    if (len <= globalfifo_low(dev) && len < dev->size &&
+        wq_has_sleeper(&dev->w_wait))
+        globalfifo_wake_w(dev);
+}
+
+static void globalfifo_rd_timeout(struct timer_list *t)
+{
+    struct globalfifo_dev *dev = timer_container_of(dev, t, rd_timer);
+
+    globalfifo_wake_r(dev);
+}
+
+/*
+ * Statistics are kept per CPU so the hot paths only touch local
+ * cachelines; readers of the counters sum over all CPUs.
+ */
+static void globalfifo_account_wait(struct globalfifo_dev *dev, bool writer,
+    u64 start)
+{
+    u64 delta = ktime_get_ns() - start;
+
+    if (writer) {
+        this_cpu_inc(dev->stats->w_waits);
+        this_cpu_add(dev->stats->w_wait_ns, delta);
+    } else {
+        this_cpu_inc(dev->stats->r_waits);
+        this_cpu_add(dev->stats->r_wait_ns, delta);
+    }
+}
+
+static void globalfifo_account_read(struct globalfifo_dev *dev, size_t size)
+{
+    this_cpu_inc(dev->stats->reads);
+    this_cpu_add(dev->stats->bytes_read, size);
+}
+
+static void globalfifo_account_write(struct globalfifo_dev *dev, size_t size)
+{
+    unsigned int len = globalfifo_len(dev);
+
+    this_cpu_inc(dev->stats->writes);
+    this_cpu_add(dev->stats->bytes_written, size);
+
+    /* racy between SPSC writers and resets, but only ever a sample */
+    if (len > READ_ONCE(dev->high_water))
+        WRITE_ONCE(dev->high_water, len);
+}
+
+static void globalfifo_get_stats(struct globalfifo_dev *dev,
+    struct globalfifo_stats *st)
+{
+    struct globalfifo_stats *pcpu = NULL;
+    int cpu = 0;
+
+    memset(st, 0, sizeof(*st));
+
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(dev->stats, cpu);
+        st->bytes_read += pcpu->bytes_read;
+        st->bytes_written += pcpu->bytes_written;
+        st->reads += pcpu->reads;
+        st->writes += pcpu->writes;
+        st->r_waits += pcpu->r_waits;
+        st->w_waits += pcpu->w_waits;
+        st->r_wait_ns += pcpu->r_wait_ns;
+        st->w_wait_ns += pcpu->w_wait_ns;
+        st->eagain += pcpu->eagain;
+        st->polls += pcpu->polls;
+    }
+
+    /* a device never opened has no ring yet */
+    st->len = smp_load_acquire(&dev->ctrl) ? globalfifo_len(dev) : 0;
+    st->size = READ_ONCE(dev->size);
+    st->high_water = READ_ONCE(dev->high_water);
+}
+
+static void globalfifo_reset_stats(struct globalfifo_dev *dev)
+{
+    int cpu = 0;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(dev->stats, cpu), 0,
+            sizeof(struct globalfifo_stats));
+    WRITE_ONCE(dev->high_water, globalfifo_len(dev));
+}
+
+/*
+ * Copies in and out of a power-of-two ring of ring_size bytes at a
+ * free-running position, wrapping at the end. The byte helpers are used
+ * for record and chunk headers.
+ */
+static void globalfifo_ring_put(unsigned char *ring, unsigned int ring_size,
+    unsigned int head, const void *buf, unsigned int size)
+{
+    unsigned int off = head & (ring_size - 1);
+    unsigned int n = min(size, ring_size - off);
+
+    memcpy(ring + off, buf, n);
+    memcpy(ring, buf + n, size - n);
+}
+
+static void globalfifo_ring_get(unsigned char *ring, unsigned int ring_size,
+    unsigned int tail, void *buf, unsigned int size)
+{
+    unsigned int off = tail & (ring_size - 1);
+    unsigned int n = min(size, ring_size - off);
+
+    memcpy(buf, ring + off, n);
+    memcpy(buf + n, ring, size - n);
+}
+
+static int globalfifo_copy_to_iter(unsigned char *ring,
+    unsigned int ring_size, struct iov_iter *to, unsigned int tail,
+    size_t size)
+{
+    unsigned int off = tail & (ring_size - 1);
+    size_t n = min_t(size_t, size, ring_size - off);
+
+    if (copy_to_iter(ring + off, n, to) != n)
+        return -EFAULT;
+    if (copy_to_iter(ring, size - n, to) != size - n)
+        return -EFAULT;
+
+    return 0;
+}
+
+static int globalfifo_copy_from_iter(unsigned char *ring,
+    unsigned int ring_size, struct iov_iter *from, unsigned int head,
+    size_t size)
+{
+    unsigned int off = head & (ring_size - 1);
+    size_t n = min_t(size_t, size, ring_size - off);
+
+    if (copy_from_iter(ring + off, n, from) != n)
+        return -EFAULT;
+    if (copy_from_iter(ring, size - n, from) != size - n)
+        return -EFAULT;
+
+    return 0;
+}
+
+static int globalfifo_alloc_ring(struct globalfifo_dev *dev);
+static void globalfifo_put(struct globalfifo_dev *dev);
+
+/* the device registered at minor, with a reference taken */
+static struct globalfifo_dev *globalfifo_get(unsigned long minor)
+{
+    struct globalfifo_dev *dev = NULL;
+
+    rcu_read_lock();
+    dev = xa_load(&globalfifo_devs, minor);
+    if (dev && !kref_get_unless_zero(&dev->kref))
+        dev = NULL;
+    rcu_read_unlock();
+
+    return dev;
+}
+
+/*
+ * In blocking broadcast mode tail follows the slowest subscriber, or
+ * head when there is none. Called with rd_mutex held.
+ */
+static void globalfifo_update_tail(struct globalfifo_dev *dev)
+{
+    struct globalfifo_file *f = NULL;
+    unsigned int tail = smp_load_acquire(&dev->ctrl->head);
+
+    list_for_each_entry(f, &dev->subs, node) {
+        if ((int)(f->pos - tail) < 0)
+            tail = f->pos;
+    }
+
+    smp_store_release(&dev->ctrl->tail, tail);
+}
+
+/* called with rd_mutex held; a subscriber only sees what comes next */
+static void globalfifo_subscribe(struct globalfifo_dev *dev,
+    struct globalfifo_file *f)
+{
+    f->pos = smp_load_acquire(&dev->ctrl->head);
+    list_add_tail(&f->node, &dev->subs);
+    WRITE_ONCE(dev->nr_subs, dev->nr_subs + 1);
+    if (!(dev->mode & GLOBALFIFO_MODE_OVERRUN))
+        globalfifo_update_tail(dev);
+}
+
+static void globalfifo_unsubscribe(struct globalfifo_dev *dev,
+    struct globalfifo_file *f)
+{
+    list_del_init(&f->node);
+    WRITE_ONCE(dev->nr_subs, dev->nr_subs - 1);
+    if (!(dev->mode & GLOBALFIFO_MODE_OVERRUN)) {
+        globalfifo_update_tail(dev);
+        globalfifo_wake_writers(dev);
+    }
+}
+
+static int globalfifo_open(struct inode *inode, struct file *filp)
+{
+    struct globalfifo_dev *dev = globalfifo_get(iminor(inode));
+    struct globalfifo_file *f = NULL;
+    int ret = 0;
+
+    /* destroyed, and maybe the minor reused, since the node was opened */
+    if (dev && dev->cdev != inode->i_cdev) {
+        globalfifo_put(dev);
+        dev = NULL;
+    }
+    if (!dev)
+        return -ENXIO;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f) {
+        globalfifo_put(dev);
+        return -ENOMEM;
+    }
+    f->dev = dev;
+    INIT_LIST_HEAD(&f->node);
+
+    mutex_lock(&dev->mutex);
+
+    if ((dev->mode & GLOBALFIFO_MODE_SPSC) &&
+        (((filp->f_mode & FMODE_READ) && dev->nr_readers) ||
+         ((filp->f_mode & FMODE_WRITE) && dev->nr_writers))) {
+        ret = -EBUSY;
+        goto out;
+    }
+
+    if (!dev->ctrl) {
+        ret = globalfifo_alloc_ring(dev);
+        if (ret)
+            goto out;
+    }
+
+    dev->nr_opens++;
+    if (filp->f_mode & FMODE_READ)
+        dev->nr_readers++;
+    if (filp->f_mode & FMODE_WRITE)
+        dev->nr_writers++;
+
+    if ((dev->mode & GLOBALFIFO_MODE_BROADCAST) &&
+        (filp->f_mode & FMODE_READ)) {
+        mutex_lock(&dev->rd_mutex);
+        globalfifo_subscribe(dev, f);
+        mutex_unlock(&dev->rd_mutex);
+    }
+
+out:
+    mutex_unlock(&dev->mutex);
+    if (ret) {
+        kfree(f);
+        globalfifo_put(dev);
+        return ret;
+    }
+
+    /* read_iter/write_iter honour IOCB_NOWAIT, so io_uring need not punt */
+    filp->f_mode |= FMODE_NOWAIT;
+    filp->private_data = f;
+    return 0;
+}
+
+static int globalfifo_release(struct inode *inode, struct file *filp)
+{
+    struct globalfifo_file *f = filp->private_data;
+    struct globalfifo_dev *dev = f->dev;
+    struct eventfd_ctx *ctx = NULL;
+
+    mutex_lock(&dev->mutex);
+    dev->nr_opens--;
+    if (filp->f_mode & FMODE_READ)
+        dev->nr_readers--;
+    if (filp->f_mode & FMODE_WRITE)
+        dev->nr_writers--;
+    if (!list_empty(&f->node)) {
+        mutex_lock(&dev->rd_mutex);
+        globalfifo_unsubscribe(dev, f);
+        mutex_unlock(&dev->rd_mutex);
+    }
+    if (dev->eventfd_filp == filp) {
+        ctx = rcu_dereference_protected(dev->eventfd,
+            lockdep_is_held(&dev->mutex));
+        RCU_INIT_POINTER(dev->eventfd, NULL);
+        dev->eventfd_filp = NULL;
+    }
+    mutex_unlock(&dev->mutex);
+
+    if (ctx) {
+        synchronize_rcu();
+        eventfd_ctx_put(ctx);
+    }
+
+    kfree(f);
+    globalfifo_put(dev);
+    return 0;
+}
+
+static void globalfifo_free_shards(struct globalfifo_dev *dev)
+{
+    unsigned int i = 0;
+
+    if (!dev->shards)
+        return;
+
+    for (i = 0; i < nr_cpu_ids; i++)
+        vfree(dev->shards[i].buf);
+    kvfree(dev->shards);
+    dev->shards = NULL;
+    dev->shard_part = NULL;
+}
+
+static int globalfifo_alloc_shards(struct globalfifo_dev *dev)
+{
+    unsigned int i = 0;
+
+    dev->shards = kvcalloc(nr_cpu_ids, sizeof(*dev->shards), GFP_KERNEL);
+    if (!dev->shards)
+        return -ENOMEM;
+
+    for (i = 0; i < nr_cpu_ids; i++) {
+        mutex_init(&dev->shards[i].lock);
+        dev->shards[i].buf = vmalloc(dev->size);
+        if (!dev->shards[i].buf) {
+            globalfifo_free_shards(dev);
+            return -ENOMEM;
+        }
+    }
+
+    dev->shard_size = dev->size;
+    dev->shard_rr = 0;
+    return 0;
+}
+
+static bool globalfifo_shards_empty(struct globalfifo_dev *dev)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < nr_cpu_ids; i++) {
+        if (smp_load_acquire(&dev->shards[i].head) != dev->shards[i].tail)
+            return false;
+    }
+
+    return true;
+}
+
+/* anything queued at all; a sharded device needs rd_mutex held */
+static bool globalfifo_has_data(struct globalfifo_dev *dev)
+{
+    if (dev->mode & GLOBALFIFO_MODE_SHARDED)
+        return !globalfifo_shards_empty(dev);
+    return globalfifo_len(dev) != 0;
+}
+
+/*
+ * Called by a reader after consuming. A writer publishing meanwhile may
+ * have found the bit still set and left the eventfd alone, so look once
+ * more after clearing it.
+ */
+static void globalfifo_mark_empty(struct globalfifo_dev *dev)
+{
+    if (!test_bit(0, &dev->ready) || globalfifo_has_data(dev))
+        return;
+
+    xa_lock(&globalfifo_devs);
+    clear_bit(0, &dev->ready);
+    if (xa_load(&globalfifo_devs, dev->minor) == dev)
+        __xa_clear_mark(&globalfifo_devs, dev->minor, GLOBALFIFO_READY);
+    xa_unlock(&globalfifo_devs);
+    smp_mb();
+    if (globalfifo_has_data(dev))
+        globalfifo_mark_ready(dev);
+}
+
+/* sub-ring of the CPU we are running on; migration only costs locality */
+static inline struct globalfifo_shard *globalfifo_local_shard(
+    struct globalfifo_dev *dev)
+{
+    return &dev->shards[raw_smp_processor_id()];
+}
+
+static bool globalfifo_shard_writable(struct globalfifo_dev *dev, size_t need)
+{
+    struct globalfifo_shard *shard = globalfifo_local_shard(dev);
+
+    return dev->shard_size -
+        (READ_ONCE(shard->head) - smp_load_acquire(&shard->tail)) >= need;
+}
+
+/*
+ * The shard holding the next chunk to read, or NULL. A partly read
+ * chunk is always finished first; otherwise the scan starts after the
+ * last shard read from, and in ordered mode only the chunk carrying the
+ * next sequence number qualifies. Called with rd_mutex held, or
+ * locklessly as a wait condition and from poll() where the answer is
+ * only a hint; a reader that consumes meanwhile rechecks and wakes.
+ */
+static struct globalfifo_shard *globalfifo_shard_next(
+    struct globalfifo_dev *dev)
+{
+    struct globalfifo_shard *shard = READ_ONCE(dev->shard_part);
+    unsigned int rr = READ_ONCE(dev->shard_rr);
+    struct globalfifo_chunk hdr;
+    unsigned int i = 0;
+
+    if (shard)
+        return shard;
+
+    for (i = 0; i < nr_cpu_ids; i++) {
+        shard = &dev->shards[(rr + i) % nr_cpu_ids];
+        if (smp_load_acquire(&shard->head) == READ_ONCE(shard->tail))
+            continue;
+        if (!(dev->mode & GLOBALFIFO_MODE_ORDERED))
+            return shard;
+
+        globalfifo_ring_get(shard->buf, dev->shard_size,
+            READ_ONCE(shard->tail), &hdr, sizeof(hdr));
+        if (hdr.seq == READ_ONCE(dev->next_seq))
+            return shard;
+    }
+
+    return NULL;
+}
+
+/*
+ * Wait conditions on the sharded paths, where a sleeper holds nothing
+ * that keeps the sub-rings alive. Leaving sharded mode frees them a
+ * grace period after the mode is published, then wakes every sleeper
+ * to look again.
+ */
+static bool globalfifo_shard_wait_write(struct globalfifo_dev *dev,
+    size_t need)
+{
+    bool ret = true;
+
+    rcu_read_lock();
+    if (smp_load_acquire(&dev->mode) & GLOBALFIFO_MODE_SHARDED)
+        ret = globalfifo_shard_writable(dev, need);
+    rcu_read_unlock();
+
+    return ret;
+}
+
+static bool globalfifo_shard_wait_read(struct globalfifo_dev *dev)
+{
+    bool ret = true;
+
+    rcu_read_lock();
+    if (smp_load_acquire(&dev->mode) & GLOBALFIFO_MODE_SHARDED)
+        ret = globalfifo_shard_next(dev) != NULL;
+    rcu_read_unlock();
+
+    return ret;
+}
+
+/*
+ * Consume n more bytes of the chunk at the shard's tail, or the rest of
+ * it if to is NULL, and copy them out. Called with rd_mutex held.
+ */
+static ssize_t globalfifo_shard_read(struct globalfifo_dev *dev,
+    struct globalfifo_shard *shard, struct iov_iter *to)
+{
+    struct globalfifo_chunk hdr;
+    size_t n = 0;
+
+    globalfifo_ring_get(shard->buf, dev->shard_size, shard->tail, &hdr,
+        sizeof(hdr));
+    n = hdr.len - shard->off;
+    if (to) {
+        n = min(n, iov_iter_count(to));
+        if (globalfifo_copy_to_iter(shard->buf, dev->shard_size, to,
+            shard->tail + sizeof(hdr) + shard->off, n))
+            return -EFAULT;
+    }
+
+    shard->off += n;
+    if (shard->off < hdr.len) {
+        WRITE_ONCE(dev->shard_part, shard);
+        return n;
+    }
+
+    shard->off = 0;
+    smp_store_release(&shard->tail, shard->tail + sizeof(hdr) + hdr.len);
+    WRITE_ONCE(dev->shard_part, NULL);
+    WRITE_ONCE(dev->shard_rr, (shard - dev->shards + 1) % nr_cpu_ids);
+    if (dev->mode & GLOBALFIFO_MODE_ORDERED)
+        WRITE_ONCE(dev->next_seq, hdr.seq + 1);
+
+    return n;
+}
+
+/*
+ * GLOBALFIFO_IOC_CLEAR for a sharded device: discard everything a reader
+ * could read right now. Writes still in flight land afterwards, and in
+ * ordered mode are not skipped over.
+ */
+static void globalfifo_clear_shards(struct globalfifo_dev *dev)
+{
+    struct globalfifo_shard *shard = NULL;
+
+    mutex_lock(&dev->rd_mutex);
+    while ((dev->mode & GLOBALFIFO_MODE_SHARDED) &&
+        (shard = globalfifo_shard_next(dev)))
+        globalfifo_shard_read(dev, shard, NULL);
+    mutex_unlock(&dev->rd_mutex);
+
+    wake_up_interruptible_all(&dev->w_wait);
+}
+
+static int globalfifo_set_mode(struct file *filp, unsigned long mode)
+{
+    struct globalfifo_file *f = filp->private_data;
+    struct globalfifo_dev *dev = f->dev;
+    unsigned int old = 0;
+    int ret = 0;
+
+    unsigned long framing = GLOBALFIFO_MODE_RECORD | GLOBALFIFO_MODE_SHARDED |
+        GLOBALFIFO_MODE_ORDERED | GLOBALFIFO_MODE_BROADCAST |
+        GLOBALFIFO_MODE_OVERRUN;
+
+    if (mode & ~(GLOBALFIFO_MODE_SPSC | framing))
+        return -EINVAL;
+    /* record framing is only implemented on the mutex paths */
+    if ((mode & GLOBALFIFO_MODE_SPSC) && (mode & GLOBALFIFO_MODE_RECORD))
+        return -EINVAL;
+    if ((mode & GLOBALFIFO_MODE_SHARDED) &&
+        (mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_RECORD)))
+        return -EINVAL;
+    if ((mode & GLOBALFIFO_MODE_ORDERED) && !(mode & GLOBALFIFO_MODE_SHARDED))
+        return -EINVAL;
+    if ((mode & GLOBALFIFO_MODE_BROADCAST) &&
+        (mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_RECORD |
+        GLOBALFIFO_MODE_SHARDED)))
+        return -EINVAL;
+    if ((mode & GLOBALFIFO_MODE_OVERRUN) &&
+        !(mode & GLOBALFIFO_MODE_BROADCAST))
+        return -EINVAL;
+
+    /*
+     * The sole opener may still have reads or writes in flight from
+     * other threads; sharded writers only hold shard_rwsem.
+     */
+    mutex_lock(&dev->mutex);
+    mutex_lock(&dev->rd_mutex);
+    mutex_lock(&dev->wr_mutex);
+    down_write(&dev->shard_rwsem);
+
+    if (dev->nr_opens != 1) {
+        ret = -EBUSY;
+        goto out;
+    }
+    old = dev->mode;
+
+    /* queued bytes cannot be reframed */
+    if ((mode ^ dev->mode) & framing) {
+        if (globalfifo_len(dev) != 0 ||
+            (dev->shards && !globalfifo_shards_empty(dev))) {
+            ret = -EBUSY;
+            goto out;
+        }
+    }
+
+    if ((mode & GLOBALFIFO_MODE_SHARDED) && !dev->shards) {
+        ret = globalfifo_alloc_shards(dev);
+        if (ret)
+            goto out;
+    }
+
+    /* a mapping consumer would move tail behind the subscribers' backs */
+    mutex_lock(&dev->map_mutex);
+    if ((mode & GLOBALFIFO_MODE_BROADCAST) && atomic_read(&dev->nr_maps)) {
+        mutex_unlock(&dev->map_mutex);
+        ret = -EBUSY;
+        goto out;
+    }
+
+    /* poll() runs without locks: seeing the sharded bit means shards too */
+    dev->next_seq = atomic64_read(&dev->seq) + 1;
+    smp_store_release(&dev->mode, mode);
+    mutex_unlock(&dev->map_mutex);
+
+    /*
+     * The caller's is the only file, so the only possible subscriber;
+     * the FIFO is empty, so it simply starts over at head.
+     */
+    if (ret == 0 && ((mode ^ old) & framing)) {
+        if (!list_empty(&f->node))
+            globalfifo_unsubscribe(dev, f);
+        if ((mode & GLOBALFIFO_MODE_BROADCAST) &&
+            (filp->f_mode & FMODE_READ))
+            globalfifo_subscribe(dev, f);
+    }
+
+    /* and a poll() that saw the bit before the switch is done with them */
+    if (!(mode & GLOBALFIFO_MODE_SHARDED) && dev->shards) {
+        synchronize_rcu();
+        globalfifo_free_shards(dev);
+    }
+
+    /* sleepers that dispatched on the old mode go round again */
+    if (mode != old) {
+        wake_up_interruptible_all(&dev->r_wait);
+        wake_up_interruptible_all(&dev->w_wait);
+    }
+
+out:
+    up_write(&dev->shard_rwsem);
+    mutex_unlock(&dev->wr_mutex);
+    mutex_unlock(&dev->rd_mutex);
+    mutex_unlock(&dev->mutex);
+
+    return ret;
+}
+
+static int globalfifo_resize(struct globalfifo_dev *dev, unsigned long size)
+{
+    unsigned char *fifo = NULL;
+    unsigned int len = 0;
+    unsigned int off = 0;
+    unsigned int n = 0;
+    int ret = 0;
+
+    if (size == 0 || size > GLOBALFIFO_MAX_SIZE)
+        return -EINVAL;
+    size = roundup_pow_of_two(size);
+
+    fifo = vmalloc_user(size);
+    if (!fifo)
+        return -ENOMEM;
+
+    mutex_lock(&dev->mutex);
+    mutex_lock(&dev->rd_mutex);
+    mutex_lock(&dev->wr_mutex);
+    mutex_lock(&dev->map_mutex);
+
+    /*
+     * mappings and the SPSC paths use the buffer without the mutex, and
+     * sharded sub-rings keep the size they were created with
+     */
+    if ((dev->mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_SHARDED |
+        GLOBALFIFO_MODE_BROADCAST)) || atomic_read(&dev->nr_maps)) {
+        ret = -EBUSY;
+        goto out;
+    }
+
+    len = globalfifo_len(dev);
+    if (len > size) {
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    /* move the queued data to the start of the new buffer */
+    off = dev->ctrl->tail & (dev->size - 1);
+    n = min(len, dev->size - off);
+    memcpy(fifo, dev->fifo + off, n);
+    memcpy(fifo + n, dev->fifo, len - n);
+
+    swap(fifo, dev->fifo);
+    WRITE_ONCE(dev->size, size);
+    dev->ctrl->size = size;
+    smp_store_release(&dev->ctrl->tail, 0);
+    smp_store_release(&dev->ctrl->head, len);
+
+    /*
+     * Blocked readers and writers recheck under their mutex once woken,
+     * so they simply carry on with the new buffer. The space changed
+     * for every writer at once, so none of them is left waiting.
+     */
+    wake_up_interruptible_all(&dev->r_wait);
+    wake_up_interruptible_all(&dev->w_wait);
+
+out:
+    mutex_unlock(&dev->map_mutex);
+    mutex_unlock(&dev->wr_mutex);
+    mutex_unlock(&dev->rd_mutex);
+    mutex_unlock(&dev->mutex);
+    vfree(fifo);
+    return ret;
+}
+
+/* GLOBALFIFO_IOC_SET_EVENTFD, replacing whatever was attached before */
+static int globalfifo_set_eventfd(struct globalfifo_dev *dev,
+    struct file *filp, int fd)
+{
+    struct eventfd_ctx *ctx = NULL;
+    struct eventfd_ctx *old = NULL;
+
+    if (fd >= 0) {
+        ctx = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ctx))
+            return PTR_ERR(ctx);
+    }
+
+    mutex_lock(&dev->mutex);
+    old = rcu_dereference_protected(dev->eventfd,
+        lockdep_is_held(&dev->mutex));
+    rcu_assign_pointer(dev->eventfd, ctx);
+    dev->eventfd_filp = ctx ? filp : NULL;
+
+    /*
+     * The edge for data already queued has passed. Signal before
+     * unlocking: once unlocked, another SET_EVENTFD or the attaching
+     * file's release() may put ctx.
+     */
+    if (ctx && test_bit(0, &dev->ready))
+        eventfd_signal(ctx);
+    mutex_unlock(&dev->mutex);
+
+    if (old) {
+        synchronize_rcu();
+        eventfd_ctx_put(old);
+    }
+
+    return 0;
+}
+
+/*
+ * GLOBALFIFO_IOC_GET_READY. A set bit may be stale, after a resize, a
+ * clear or a mapping consumer, so each one is checked; a device whose
+ * reader is busy counts as ready rather than being waited for.
+ */
+static long globalfifo_get_ready(struct globalfifo_ready __user *arg)
+{
+    struct globalfifo_ready rq;
+    struct globalfifo_dev *dev = NULL;
+    u64 __user *mask = NULL;
+    unsigned long i = 0;
+    unsigned int nbits = 0;
+    unsigned int w = 0;
+    bool ready = false;
+    u64 word = 0;
+    long nr = 0;
+
+    if (copy_from_user(&rq, arg, sizeof(rq)))
+        return -EFAULT;
+    if (rq.nbits == 0)
+        return -EINVAL;
+
+    nbits = min_t(u32, rq.nbits, GLOBALFIFO_MAX_MINORS);
+    mask = u64_to_user_ptr(rq.mask);
+    if (clear_user(mask, DIV_ROUND_UP(nbits, 64) * sizeof(u64)))
+        return -EFAULT;
+
+    /* the marks make this a walk over the ready devices only */
+    for (i = 0; xa_find(&globalfifo_devs, &i, nbits - 1, GLOBALFIFO_READY);
+        i++) {
+        dev = globalfifo_get(i);
+        if (!dev)
+            continue;
+        ready = true;
+        if (mutex_trylock(&dev->rd_mutex)) {
+            globalfifo_mark_empty(dev);
+            mutex_unlock(&dev->rd_mutex);
+            ready = test_bit(0, &dev->ready);
+        }
+        globalfifo_put(dev);
+        if (!ready)
+            continue;
+
+        if (i / 64 != w) {
+            if (word && put_user(word, mask + w))
+                return -EFAULT;
+            w = i / 64;
+            word = 0;
+        }
+        word |= 1ULL << (i % 64);
+        nr++;
+    }
+
+    if (word && put_user(word, mask + w))
+        return -EFAULT;
+
+    return nr;
+}
+
+static long globalfifo_recv_mmsg(struct file *filp,
+    struct globalfifo_mmsg __user *arg);
+static long globalfifo_send_mmsg(struct file *filp,
+    struct globalfifo_mmsg __user *arg);
+
+static long globalfifo_ioctl(struct file *filp,
+    unsigned int cmd, unsigned long arg)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+    struct globalfifo_file *f = NULL;
+    struct globalfifo_stats st;
+    struct globalfifo_wmark wmark;
+
+    switch (cmd) {
+    case GLOBALFIFO_IOC_CLEAR:
+        if (dev->mode & GLOBALFIFO_MODE_SHARDED) {
+            globalfifo_clear_shards(dev);
+            trace_globalfifo_clear(dev->minor);
+            break;
+        }
+
+        if (dev->mode & GLOBALFIFO_MODE_SPSC) {
+            /* only the consumer may move tail without the mutex */
+            if (!(filp->f_mode & FMODE_READ))
+                return -EPERM;
+            smp_store_release(&dev->ctrl->tail,
+                smp_load_acquire(&dev->ctrl->head));
+            globalfifo_wake_w(dev);
+            trace_globalfifo_clear(dev->minor);
+            break;
+        }
+
+        /* a writer would be copying into the space being cleared */
+        mutex_lock(&dev->rd_mutex);
+        mutex_lock(&dev->wr_mutex);
+        memset(dev->fifo, 0, dev->size);
+        smp_store_release(&dev->ctrl->tail, dev->ctrl->head);
+        list_for_each_entry(f, &dev->subs, node)
+            WRITE_ONCE(f->pos, dev->ctrl->head);
+        wake_up_interruptible_all(&dev->w_wait);
+        mutex_unlock(&dev->wr_mutex);
+        mutex_unlock(&dev->rd_mutex);
+        trace_globalfifo_clear(dev->minor);
+        break;
+
+    case GLOBALFIFO_IOC_SET_MODE:
+        return globalfifo_set_mode(filp, arg);
+
+    case GLOBALFIFO_IOC_GET_MODE:
+        return dev->mode;
+
+    case GLOBALFIFO_IOC_RESIZE:
+        return globalfifo_resize(dev, arg);
+
+    case GLOBALFIFO_IOC_GET_SIZE:
+        return READ_ONCE(dev->size);
+
+    case GLOBALFIFO_IOC_RING_WAKE:
+        WRITE_ONCE(dev->ctrl->writer_waiting, 0);
+        globalfifo_wake_w(dev);
+        break;
+
+    case GLOBALFIFO_IOC_GET_STATS:
+        globalfifo_get_stats(dev, &st);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+            return -EFAULT;
+        break;
+
+    case GLOBALFIFO_IOC_RESET_STATS:
+        globalfifo_reset_stats(dev);
+        break;
+
+    case GLOBALFIFO_IOC_SET_WMARK:
+        if (copy_from_user(&wmark, (void __user *)arg, sizeof(wmark)))
+            return -EFAULT;
+        if (wmark.high == 0)
+            return -EINVAL;
+
+        WRITE_ONCE(dev->low_wmark, wmark.low);
+        WRITE_ONCE(dev->high_wmark, wmark.high);
+        WRITE_ONCE(dev->wmark_timeout_ms, wmark.timeout_ms);
+
+        /* let every sleeper recheck against the new thresholds */
+        wake_up_interruptible_all(&dev->r_wait);
+        wake_up_interruptible_all(&dev->w_wait);
+        break;
+
+    case GLOBALFIFO_IOC_GET_WMARK:
+        wmark.low = READ_ONCE(dev->low_wmark);
+        wmark.high = READ_ONCE(dev->high_wmark);
+        wmark.timeout_ms = READ_ONCE(dev->wmark_timeout_ms);
+        if (copy_to_user((void __user *)arg, &wmark, sizeof(wmark)))
+            return -EFAULT;
+        break;
+
+    /* the batches work on the single ring under rd_mutex/wr_mutex */
+    case GLOBALFIFO_IOC_RECV_MMSG:
+        if (dev->mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_SHARDED |
+            GLOBALFIFO_MODE_BROADCAST))
+            return -EINVAL;
+        return globalfifo_recv_mmsg(filp, (void __user *)arg);
+
+    case GLOBALFIFO_IOC_SEND_MMSG:
+        if (dev->mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_SHARDED |
+            GLOBALFIFO_MODE_BROADCAST))
+            return -EINVAL;
+        return globalfifo_send_mmsg(filp, (void __user *)arg);
+
+    case GLOBALFIFO_IOC_SET_EVENTFD:
+        return globalfifo_set_eventfd(dev, filp, (int)arg);
+
+    case GLOBALFIFO_IOC_GET_READY:
+        return globalfifo_get_ready((void __user *)arg);
+
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* bytes a broadcast subscriber has yet to read, or lost to an overrun */
+static inline unsigned int globalfifo_sub_len(struct globalfifo_dev *dev,
+    struct globalfifo_file *f)
+{
+    return smp_load_acquire(&dev->ctrl->head) - READ_ONCE(f->pos);
+}
+
+static unsigned int globalfifo_poll(struct file *filp,
+    struct poll_table_struct *wait)
+{
+    unsigned int mask = 0;
+    unsigned int mode = 0;
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+
+    this_cpu_inc(dev->stats->polls);
+
+    poll_wait(filp, &dev->r_wait, wait);
+    poll_wait(filp, &dev->w_wait, wait);
+
+    /*
+     * No lock is taken; the answer comes from the published head and
+     * tail. The barrier pairs with wq_has_sleeper() on the read and
+     * write paths: either they see this waiter and wake it, or it sees
+     * what they published. An answer made stale by a reader or a resize
+     * running meanwhile is followed by a wakeup from them.
+     */
+    smp_mb();
+
+    rcu_read_lock();
+    mode = smp_load_acquire(&dev->mode);
+    if (mode & GLOBALFIFO_MODE_SHARDED) {
+        if (globalfifo_shard_next(dev))
+            mask |= POLLIN | POLLRDNORM;
+        if (globalfifo_shard_writable(dev, sizeof(struct globalfifo_chunk) + 1))
+            mask |= POLLOUT | POLLWRNORM;
+    } else if (mode & GLOBALFIFO_MODE_BROADCAST) {
+        if ((filp->f_mode & FMODE_READ) &&
+            globalfifo_sub_len(dev, filp->private_data))
+            mask |= POLLIN | POLLRDNORM;
+        if ((mode & GLOBALFIFO_MODE_OVERRUN) ||
+            globalfifo_len(dev) <= globalfifo_low(dev))
+            mask |= POLLOUT | POLLWRNORM;
+    } else {
+        if (globalfifo_readable(dev))
+            mask |= POLLIN | POLLRDNORM;
+        if (globalfifo_len(dev) <= globalfifo_low(dev))
+            mask |= POLLOUT | POLLWRNORM;
+    }
+    rcu_read_unlock();
+
+    return mask;
+}
+
+/*
+ * The request may not sleep for data or space: the file is O_NONBLOCK,
+ * or the request is IOCB_NOWAIT, as io_uring issues it inline.
+ */
+static inline bool globalfifo_nonblock(struct kiocb *iocb)
+{
+    return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+        (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/*
+ * An IOCB_NOWAIT request must not sleep on a lock either; it gets
+ * EAGAIN and io_uring retries once poll() reports the FIFO ready.
+ */
+static int globalfifo_lock(struct kiocb *iocb, struct mutex *lock)
+{
+    if (!(iocb->ki_flags & IOCB_NOWAIT)) {
+        mutex_lock(lock);
+        return 0;
+    }
+
+    return mutex_trylock(lock) ? 0 : -EAGAIN;
+}
+
+/*
+ * SPSC mode: the reader owns tail and the writer owns head. Each side
+ * reads the other's index with acquire and publishes its own with
+ * release, so the data copy is ordered against the index update and no
+ * lock is needed between one producer and one consumer.
+ */
+static ssize_t globalfifo_read_spsc(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(iocb->ki_filp);
+    size_t size = iov_iter_count(to);
+    unsigned int tail = READ_ONCE(dev->ctrl->tail);
+    unsigned int len = 0;
+    u64 start = 0;
+    int ret = 0;
+
+    while ((len = globalfifo_len(dev)) == 0) {
+        if (globalfifo_nonblock(iocb)) {
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
+
+        trace_globalfifo_wait(dev->minor, false);
+        start = ktime_get_ns();
+        ret = wait_event_interruptible_exclusive(dev->r_wait,
+            globalfifo_readable(dev));
+        globalfifo_account_wait(dev, false, start);
+        if (ret)
+            return -ERESTARTSYS;
+    }
+
+    if (size > len)
+        size = len;
+
+    if (globalfifo_copy_to_iter(dev->fifo, dev->size, to, tail, size))
+        return -EFAULT;
+
+    smp_store_release(&dev->ctrl->tail, tail + size);
+    globalfifo_account_read(dev, size);
+    trace_globalfifo_read(dev->minor, size, globalfifo_len(dev));
+    globalfifo_mark_empty(dev);
+    globalfifo_wake_writers(dev);
+
+    return size;
+}
+
+static ssize_t globalfifo_write_spsc(struct kiocb *iocb,
+    struct iov_iter *from)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(iocb->ki_filp);
+    size_t size = iov_iter_count(from);
+    unsigned int head = READ_ONCE(dev->ctrl->head);
+    unsigned int space = 0;
+    u64 start = 0;
+    int ret = 0;
+
+    while ((space = dev->size - globalfifo_len(dev)) == 0) {
+        if (globalfifo_nonblock(iocb)) {
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
+
+        trace_globalfifo_wait(dev->minor, true);
+        start = ktime_get_ns();
+        ret = wait_event_interruptible_exclusive(dev->w_wait,
+            globalfifo_writable(dev, 1));
+        globalfifo_account_wait(dev, true, start);
+        if (ret)
+            return -ERESTARTSYS;
+    }
+
+    if (size > space)
+        size = space;
+
+    if (globalfifo_copy_from_iter(dev->fifo, dev->size, from, head, size))
+        return -EFAULT;
+
+    smp_store_release(&dev->ctrl->head, head + size);
+    globalfifo_account_write(dev, size);
+    trace_globalfifo_write(dev->minor, size, globalfifo_len(dev));
+    globalfifo_wake_readers(dev, head);
+
+    return size;
+}
+
+static ssize_t globalfifo_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t globalfifo_write_iter(struct kiocb *iocb,
+    struct iov_iter *from);
+
+/*
+ * Sharded write: the whole write goes to the local sub-ring under that
+ * sub-ring's lock, so writers on different CPUs share no lock. In
+ * ordered mode the stamp is taken once space is reserved, and a failed
+ * copy still publishes an empty chunk so the sequence has no holes.
+ * shard_rwsem, held shared, keeps set_mode() from freeing the sub-rings
+ * underneath; it is dropped while sleeping. The copy may fault and take
+ * mmap_lock with it held, which is safe as mmap() only takes map_mutex.
+ */
+static ssize_t globalfifo_write_shard(struct kiocb *iocb,
+    struct iov_iter *from)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(iocb->ki_filp);
+    struct globalfifo_shard *shard = NULL;
+    struct globalfifo_chunk hdr;
+    size_t size = iov_iter_count(from);
+    size_t need = sizeof(hdr) + size;
+    u64 start = 0;
+    int ret = 0;
+
+    if (size == 0)
+        return 0;
+
+    for (;;) {
+        if (iocb->ki_flags & IOCB_NOWAIT) {
+            if (!down_read_trylock(&dev->shard_rwsem)) {
+                this_cpu_inc(dev->stats->eagain);
+                return -EAGAIN;
+            }
+        } else {
+            down_read(&dev->shard_rwsem);
+        }
+
+        /* the mode changed while we slept or before we got here */
+        if (!(dev->mode & GLOBALFIFO_MODE_SHARDED)) {
+            up_read(&dev->shard_rwsem);
+            return globalfifo_write_iter(iocb, from);
+        }
+        if (need > dev->shard_size) {
+            up_read(&dev->shard_rwsem);
+            return -EMSGSIZE;
+        }
+
+        shard = globalfifo_local_shard(dev);
+        if (globalfifo_lock(iocb, &shard->lock)) {
+            up_read(&dev->shard_rwsem);
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
+        if (dev->shard_size - (shard->head -
+            smp_load_acquire(&shard->tail)) >= need)
+            break;
+        mutex_unlock(&shard->lock);
+        up_read(&dev->shard_rwsem);
+
+        if (globalfifo_nonblock(iocb)) {
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
+
+        /*
+         * Not exclusive: each writer waits for room in its own CPU's
+         * sub-ring, so a wakeup one of them cannot use must not be
+         * swallowed on behalf of the others.
+         */
+        trace_globalfifo_wait(dev->minor, true);
+        start = ktime_get_ns();
+        ret = wait_event_interruptible(dev->w_wait,
+            globalfifo_shard_wait_write(dev, need));
+        globalfifo_account_wait(dev, true, start);
+        if (ret)
+            return -ERESTARTSYS;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = size;
+    if (globalfifo_copy_from_iter(shard->buf, dev->shard_size, from,
+        shard->head + sizeof(hdr), size)) {
+        ret = -EFAULT;
+        hdr.len = 0;
+    }
+
+    if (dev->mode & GLOBALFIFO_MODE_ORDERED)
+        hdr.seq = atomic64_inc_return(&dev->seq);
+    else if (ret)
+        goto out;
+
+    globalfifo_ring_put(shard->buf, dev->shard_size, shard->head, &hdr,
+        sizeof(hdr));
+    smp_store_release(&shard->head, shard->head + sizeof(hdr) + hdr.len);
+    globalfifo_mark_ready(dev);
+
+out:
+    mutex_unlock(&shard->lock);
+    up_read(&dev->shard_rwsem);
+
+    if (!ret) {
+        globalfifo_account_write(dev, size);
+        trace_globalfifo_write(dev->minor, size, 0);
+        ret = size;
+    }
+    if ((hdr.len || (dev->mode & GLOBALFIFO_MODE_ORDERED)) &&
+        wq_has_sleeper(&dev->r_wait))
+        globalfifo_wake_r(dev);
+
+    return ret;
+}
+
+/*
+ * Sharded read: merge chunks from the sub-rings until the buffer is
+ * full or nothing more is readable. Readers serialise on rd_mutex.
+ */
+static ssize_t globalfifo_read_shards(struct kiocb *iocb,
+    struct iov_iter *to)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(iocb->ki_filp);
+    struct globalfifo_shard *shard = NULL;
+    ssize_t copied = 0;
+    ssize_t ret = 0;
+    bool more = false;
+    u64 start = 0;
+
+    if (globalfifo_lock(iocb, &dev->rd_mutex)) {
+        this_cpu_inc(dev->stats->eagain);
+        return -EAGAIN;
+    }
+
+    /* empty chunks left by failed ordered writes yield no bytes */
+    while (copied == 0 && iov_iter_count(to)) {
+        /* set_mode() frees the sub-rings under rd_mutex */
+        if (!(dev->mode & GLOBALFIFO_MODE_SHARDED)) {
+            mutex_unlock(&dev->rd_mutex);
+            return globalfifo_read_iter(iocb, to);
+        }
+
+        shard = globalfifo_shard_next(dev);
+        if (!shard) {
+            if (globalfifo_nonblock(iocb)) {
+                this_cpu_inc(dev->stats->eagain);
+                ret = -EAGAIN;
+                break;
+            }
+
+            mutex_unlock(&dev->rd_mutex);
+            trace_globalfifo_wait(dev->minor, false);
+            start = ktime_get_ns();
+            ret = wait_event_interruptible_exclusive(dev->r_wait,
+                globalfifo_shard_wait_read(dev));
+            globalfifo_account_wait(dev, false, start);
+            mutex_lock(&dev->rd_mutex);
+            if (ret) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+
+        do {
+            ret = globalfifo_shard_read(dev, shard, to);
+            if (ret < 0)
+                break;
+            copied += ret;
+        } while (iov_iter_count(to) && (shard = globalfifo_shard_next(dev)));
+        if (ret < 0)
+            break;
+    }
+
+    if (copied) {
+        globalfifo_mark_empty(dev);
+        more = globalfifo_shard_next(dev) != NULL;
+    }
+    mutex_unlock(&dev->rd_mutex);
+
+    if (copied == 0)
+        return ret;
+
+    globalfifo_account_read(dev, copied);
+    trace_globalfifo_read(dev->minor, copied, 0);
+    if (wq_has_sleeper(&dev->w_wait))
+        globalfifo_wake_w(dev);
+    if (more && wq_has_sleeper(&dev->r_wait))
+        globalfifo_wake_r(dev);
+
+    return copied;
+}
+
+/*
+ * Length of the record at tail, called with rd_mutex held on a
+ * non-empty FIFO. A mapping consumer can move tail anywhere, so the
+ * header is checked against what is actually queued.
+ */
+static ssize_t globalfifo_next_record(struct globalfifo_dev *dev,
+    size_t count)
+{
+    unsigned int len = globalfifo_len(dev);
+    __u32 rlen = 0;
+
+    if (len < GLOBALFIFO_RECORD_HDR)
+        return -EIO;
+
+    globalfifo_ring_get(dev->fifo, dev->size, dev->ctrl->tail, &rlen,
+        GLOBALFIFO_RECORD_HDR);
+    if (rlen > len - GLOBALFIFO_RECORD_HDR)
+        return -EIO;
+    if (rlen > count)
+        return -EMSGSIZE;
+
+    return rlen;
+}
+
+/*
+ * Sleep until the FIFO has data. Called with rd_mutex held and returns
+ * with it held; it is dropped while asleep. Returns 1 if set_mode()
+ * changed the mode meanwhile, and the caller has to start over in the
+ * new one.
+ */
+static int globalfifo_wait_data(struct globalfifo_dev *dev, bool nonblock)
+{
+    unsigned int mode = dev->mode;
+    int ret = 0;
+    u64 start = 0;
 
-static int globalfifo_major = GLOBALFIFO_MAJOR;
-module_param(globalfifo_major, int, S_IRUGO);
+    while (globalfifo_len(dev) == 0) {
+        if (nonblock) {
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
 
-struct globalfifo_dev {
-    struct cdev cdev;
-    unsigned int current_len;
-    unsigned char fifo[GLOBALFIFO_SIZE];
-    struct mutex mutex;
-    wait_queue_head_t r_wait;
-    wait_queue_head_t w_wait;
-};
+        mutex_unlock(&dev->rd_mutex);
+        trace_globalfifo_wait(dev->minor, false);
+        start = ktime_get_ns();
+        ret = wait_event_interruptible_exclusive(dev->r_wait,
+            globalfifo_readable(dev) || READ_ONCE(dev->mode) != mode);
+        globalfifo_account_wait(dev, false, start);
+        mutex_lock(&dev->rd_mutex);
+        if (ret) {
+            printk(KERN_ERR "globalfifo wait for reading failed\n");
+            return -ERESTARTSYS;
+        }
+        if (dev->mode != mode)
+            return 1;
+    }
 
-struct globalfifo_dev *globalfifo_devp;
+    return 0;
+}
 
-static int globalfifo_open(struct inode *inode, struct file *filp)
+/* as globalfifo_wait_data() on wr_mutex, until need bytes are free */
+static int globalfifo_wait_space(struct globalfifo_dev *dev, size_t need,
+    bool nonblock)
 {
-    struct globalfifo_dev *dev = container_of(inode->i_cdev,
-        struct globalfifo_dev, cdev);
-    filp->private_data = dev;
+    unsigned int mode = dev->mode;
+    int ret = 0;
+    u64 start = 0;
+
+    while (dev->size - globalfifo_len(dev) < need) {
+        if (need > dev->size)
+            return -EMSGSIZE;
+        if (nonblock) {
+            this_cpu_inc(dev->stats->eagain);
+            return -EAGAIN;
+        }
+
+        /*
+         * Records need different amounts of space, so a writer that
+         * cannot use a wakeup must not swallow it: those wait shared.
+         */
+        mutex_unlock(&dev->wr_mutex);
+        trace_globalfifo_wait(dev->minor, true);
+        start = ktime_get_ns();
+        if (mode & GLOBALFIFO_MODE_RECORD)
+            ret = wait_event_interruptible(dev->w_wait,
+                globalfifo_writable(dev, need) ||
+                READ_ONCE(dev->mode) != mode);
+        else
+            ret = wait_event_interruptible_exclusive(dev->w_wait,
+                globalfifo_writable(dev, need) ||
+                READ_ONCE(dev->mode) != mode);
+        globalfifo_account_wait(dev, true, start);
+        mutex_lock(&dev->wr_mutex);
+        if (ret) {
+            printk(KERN_ERR "globalfifo wait for writing failed\n");
+            return -ERESTARTSYS;
+        }
+        if (dev->mode != mode)
+            return 1;
+    }
+
     return 0;
 }
 
-static int globalfifo_release(struct inode *inode, struct file *filp)
+/* a record goes in whole, a stream write takes whatever space there is */
+static size_t globalfifo_space_needed(struct globalfifo_dev *dev, size_t size)
 {
-    return 0;
+    if (dev->mode & GLOBALFIFO_MODE_RECORD)
+        return GLOBALFIFO_RECORD_HDR + size;
+    return 1;
 }
 
-static long globalfifo_ioctl(struct file *filp,
-    unsigned int cmd, unsigned long arg)
+/*
+ * Move one record, or as many bytes as fit, from a non-empty FIFO to
+ * the iterator. Called with rd_mutex held; waking writers is left to
+ * the caller so a batch can do it once.
+ */
+static ssize_t globalfifo_read_locked(struct globalfifo_dev *dev,
+    struct iov_iter *to)
 {
-    struct globalfifo_dev *dev = filp->private_data;
+    size_t size = iov_iter_count(to);
+    unsigned int hdr = 0;
+    ssize_t ret = 0;
 
-    switch (cmd) {
-    case GLOBALFIFO_IOC_CLEAR:
-        mutex_lock(&dev->mutex);
-        memset(dev->fifo, 0, GLOBALFIFO_SIZE);
-        dev->current_len = 0;
-        mutex_unlock(&dev->mutex);
-        printk(KERN_INFO "globalfifo is set to zero\n");
-        break;
+    if (dev->mode & GLOBALFIFO_MODE_RECORD) {
+        ret = globalfifo_next_record(dev, size);
+        if (ret < 0)
+            return ret;
+        size = ret;
+        hdr = GLOBALFIFO_RECORD_HDR;
+    } else if (size > globalfifo_len(dev)) {
+        size = globalfifo_len(dev);
+    }
 
-    default:
-        return -EINVAL;
+    if (globalfifo_copy_to_iter(dev->fifo, dev->size, to,
+        dev->ctrl->tail + hdr, size)) {
+        printk(KERN_ERR "globalfifo copy driver data to user buffer failed\n");
+        return -EFAULT;
     }
 
-    return 0;
+    smp_store_release(&dev->ctrl->tail, dev->ctrl->tail + hdr + size);
+    globalfifo_account_read(dev, size);
+    trace_globalfifo_read(dev->minor, size, globalfifo_len(dev));
+    return size;
 }
 
-static unsigned int globalfifo_poll(struct file *filp,
-    struct poll_table_struct *wait)
+/*
+ * Counterpart of globalfifo_read_locked(), called with wr_mutex held
+ * once globalfifo_space_needed() bytes are free. Only head moves here,
+ * so a reader can copy out of the queued part meanwhile.
+ */
+static ssize_t globalfifo_write_locked(struct globalfifo_dev *dev,
+    struct iov_iter *from)
 {
-    unsigned int mask = 0;
-    struct globalfifo_dev *dev = filp->private_data;
-
-    mutex_lock(&dev->mutex);
+    size_t size = iov_iter_count(from);
+    unsigned int hdr = 0;
+    __u32 rlen = 0;
 
-    poll_wait(filp, &dev->r_wait, wait);
-    poll_wait(filp, &dev->w_wait, wait);
+    /* an empty record would read back as end of file */
+    if (size == 0)
+        return 0;
 
-    if (dev->current_len != 0) {
-        mask |= POLLIN | POLLRDNORM;
+    if (dev->mode & GLOBALFIFO_MODE_RECORD) {
+        hdr = GLOBALFIFO_RECORD_HDR;
+        rlen = size;
+        globalfifo_ring_put(dev->fifo, dev->size, dev->ctrl->head, &rlen,
+            hdr);
+    } else if (size > dev->size - globalfifo_len(dev)) {
+        size = dev->size - globalfifo_len(dev);
     }
 
-    if (dev->current_len != GLOBALFIFO_SIZE) {
-        mask |= POLLOUT | POLLWRNORM;
+    if (globalfifo_copy_from_iter(dev->fifo, dev->size, from,
+        dev->ctrl->head + hdr, size)) {
+        printk(KERN_ERR "globalfifo copy user data to driver buffer failed\n");
+        return -EFAULT;
     }
 
-    mutex_unlock(&dev->mutex);
-    return mask;
+    smp_store_release(&dev->ctrl->head, dev->ctrl->head + hdr + size);
+    globalfifo_account_write(dev, size);
+    trace_globalfifo_write(dev->minor, size, globalfifo_len(dev));
+    return size;
 }
 
-static ssize_t globalfifo_read(struct file *filp,
-    char __user *buf, size_t size, loff_t *ppos)
+/*
+ * Broadcast read: every subscriber reads the whole stream from its own
+ * position, so they all wait shared and are all woken by each write.
+ * In overrun mode the writer moves tail past data it is about to
+ * overwrite before copying, and the position is checked against tail
+ * again after the copy, as with a seqlock. A subscriber that has been
+ * overrun gets EOVERFLOW once and carries on from the oldest byte left.
+ */
+static ssize_t globalfifo_read_broadcast(struct kiocb *iocb,
+    struct iov_iter *to)
 {
-    int ret = 0;
-    struct globalfifo_dev *dev = filp->private_data;
+    struct globalfifo_file *f = iocb->ki_filp->private_data;
+    struct globalfifo_dev *dev = f->dev;
+    size_t size = iov_iter_count(to);
+    unsigned int pos = 0;
+    unsigned int len = 0;
+    ssize_t ret = 0;
+    u64 start = 0;
 
-    mutex_lock(&dev->mutex);
+    if (globalfifo_lock(iocb, &dev->rd_mutex)) {
+        this_cpu_inc(dev->stats->eagain);
+        return -EAGAIN;
+    }
 
-    while (dev->current_len == 0) {
-        if (filp->f_flags & O_NONBLOCK) {
+    while ((len = globalfifo_sub_len(dev, f)) == 0) {
+        if (globalfifo_nonblock(iocb)) {
+            this_cpu_inc(dev->stats->eagain);
             ret = -EAGAIN;
-            goto exit1;
-        } else {
-            mutex_unlock(&dev->mutex);
-            ret = wait_event_interruptible(dev->r_wait, (dev->current_len > 0));
-            if (ret == 0) {
-                mutex_lock(&dev->mutex);
-            } else {
-                printk(KERN_ERR "globalfifo wait for reading failed\n");
-                ret = -ERESTARTSYS;
-                goto exit2;
-            }
+            goto out;
         }
-    }
 
-    if (size > dev->current_len) {
-        size = dev->current_len;
+        mutex_unlock(&dev->rd_mutex);
+        trace_globalfifo_wait(dev->minor, false);
+        start = ktime_get_ns();
+        ret = wait_event_interruptible(dev->r_wait,
+            globalfifo_sub_len(dev, f) != 0 ||
+            !(READ_ONCE(dev->mode) & GLOBALFIFO_MODE_BROADCAST));
+        globalfifo_account_wait(dev, false, start);
+        mutex_lock(&dev->rd_mutex);
+        if (ret) {
+            ret = -ERESTARTSYS;
+            goto out;
+        }
+        /* set_mode() switched away and dropped our subscription */
+        if (!(dev->mode & GLOBALFIFO_MODE_BROADCAST)) {
+            mutex_unlock(&dev->rd_mutex);
+            return globalfifo_read_iter(iocb, to);
+        }
     }
 
-    if (copy_to_user(buf, dev->fifo, size)) {
-        printk(KERN_ERR "globalfifo copy driver data to user buffer failed\n");
+    pos = f->pos;
+    if ((int)(READ_ONCE(dev->ctrl->tail) - pos) > 0)
+        goto overrun;
+
+    size = min_t(size_t, size, len);
+    if (globalfifo_copy_to_iter(dev->fifo, dev->size, to, pos, size)) {
         ret = -EFAULT;
-    } else {
-        memcpy(dev->fifo, dev->fifo + size, dev->current_len - size);
-        dev->current_len -= size;
-        printk(KERN_INFO "globalfifo read %lu bytes, current_len: %u\n",
-            size, dev->current_len);
-        wake_up_interruptible(&dev->w_wait);
+        goto out;
+    }
+
+    smp_rmb();
+    if ((int)(READ_ONCE(dev->ctrl->tail) - pos) > 0)
+        goto overrun;
+
+    WRITE_ONCE(f->pos, pos + size);
+    globalfifo_account_read(dev, size);
+    trace_globalfifo_read(dev->minor, size, len - size);
+    ret = size;
+
+    /* the slowest subscriber holds the writers back */
+    if (!(dev->mode & GLOBALFIFO_MODE_OVERRUN) &&
+        pos == dev->ctrl->tail) {
+        globalfifo_update_tail(dev);
+        globalfifo_mark_empty(dev);
+        globalfifo_wake_writers(dev);
+    }
+    goto out;
+
+overrun:
+    WRITE_ONCE(f->pos, READ_ONCE(dev->ctrl->tail));
+    ret = -EOVERFLOW;
+out:
+    mutex_unlock(&dev->rd_mutex);
+    return ret;
+}
+
+/*
+ * Broadcast write. With no subscriber the data has nobody to go to and
+ * is dropped. Otherwise it waits for the slowest subscriber, or in
+ * overrun mode retires the oldest bytes to make room, so it never
+ * waits and globalfifo_write_locked() takes at most the ring's size.
+ */
+static ssize_t globalfifo_write_broadcast(struct kiocb *iocb,
+    struct iov_iter *from)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(iocb->ki_filp);
+    size_t size = iov_iter_count(from);
+    unsigned int tail = 0;
+    ssize_t ret = 0;
+
+    if (globalfifo_lock(iocb, &dev->wr_mutex)) {
+        this_cpu_inc(dev->stats->eagain);
+        return -EAGAIN;
+    }
+
+    if (READ_ONCE(dev->nr_subs) == 0) {
+        iov_iter_advance(from, size);
         ret = size;
+        goto out;
     }
 
-exit1:
-    mutex_unlock(&dev->mutex);
-exit2:
+    if (dev->mode & GLOBALFIFO_MODE_OVERRUN) {
+        size = min_t(size_t, size, dev->size);
+        tail = dev->ctrl->head + size - dev->size;
+        if ((int)(tail - dev->ctrl->tail) > 0) {
+            WRITE_ONCE(dev->ctrl->tail, tail);
+            /* pairs with smp_rmb() in globalfifo_read_broadcast() */
+            smp_wmb();
+        }
+    } else {
+        ret = globalfifo_wait_space(dev, 1, globalfifo_nonblock(iocb));
+        if (ret > 0) {
+            mutex_unlock(&dev->wr_mutex);
+            return globalfifo_write_iter(iocb, from);
+        }
+        if (ret)
+            goto out;
+    }
+
+    ret = globalfifo_write_locked(dev, from);
+    if (ret > 0) {
+        globalfifo_mark_ready(dev);
+        if (wq_has_sleeper(&dev->r_wait))
+            globalfifo_wake_r(dev);
+        if (!(dev->mode & GLOBALFIFO_MODE_OVERRUN))
+            globalfifo_pass_on_write(dev);
+    }
+
+out:
+    mutex_unlock(&dev->wr_mutex);
     return ret;
 }
 
-static ssize_t globalfifo_write(struct file *filp,
-    const char __user *buf, size_t size, loff_t *ppos)
+/*
+ * read() and readv() both come through here, so all segments of a
+ * vectored read are filled under a single rd_mutex acquisition.
+ */
+static ssize_t globalfifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    int ret = 0;
-    struct globalfifo_dev *dev = filp->private_data;
+    ssize_t ret = 0;
+    struct file *filp = iocb->ki_filp;
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
 
-    mutex_lock(&dev->mutex);
+    if (dev->mode & GLOBALFIFO_MODE_SPSC)
+        return globalfifo_read_spsc(iocb, to);
+    if (dev->mode & GLOBALFIFO_MODE_SHARDED)
+        return globalfifo_read_shards(iocb, to);
+    if (dev->mode & GLOBALFIFO_MODE_BROADCAST)
+        return globalfifo_read_broadcast(iocb, to);
 
-    while (dev->current_len == GLOBALFIFO_SIZE) {
-        if (filp->f_flags & O_NONBLOCK) {
-            ret = -EAGAIN;
-            goto exit1;
-        } else {
-            mutex_unlock(&dev->mutex);
-            ret = wait_event_interruptible(dev->w_wait,
-                (dev->current_len < GLOBALFIFO_SIZE));
-            if (ret == 0) {
-                mutex_lock(&dev->mutex);
-            } else {
-                printk(KERN_ERR "globalfifo wait for writing failed\n");
-                ret = -ERESTARTSYS;
-                goto exit2;
-            }
+    if (globalfifo_lock(iocb, &dev->rd_mutex)) {
+        this_cpu_inc(dev->stats->eagain);
+        return -EAGAIN;
+    }
+
+    ret = globalfifo_wait_data(dev, globalfifo_nonblock(iocb));
+    if (ret > 0) {
+        mutex_unlock(&dev->rd_mutex);
+        return globalfifo_read_iter(iocb, to);
+    }
+    if (ret)
+        goto out;
+
+    ret = globalfifo_read_locked(dev, to);
+    if (ret >= 0) {
+        globalfifo_mark_empty(dev);
+        globalfifo_wake_writers(dev);
+        globalfifo_pass_on_read(dev);
+    }
+
+out:
+    mutex_unlock(&dev->rd_mutex);
+    return ret;
+}
+
+static ssize_t globalfifo_write_iter(struct kiocb *iocb,
+    struct iov_iter *from)
+{
+    ssize_t ret = 0;
+    unsigned int head = 0;
+    struct file *filp = iocb->ki_filp;
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+    size_t size = iov_iter_count(from);
+
+    if (dev->mode & GLOBALFIFO_MODE_SPSC)
+        return globalfifo_write_spsc(iocb, from);
+    if (dev->mode & GLOBALFIFO_MODE_SHARDED)
+        return globalfifo_write_shard(iocb, from);
+    if (dev->mode & GLOBALFIFO_MODE_BROADCAST)
+        return globalfifo_write_broadcast(iocb, from);
+
+    if (globalfifo_lock(iocb, &dev->wr_mutex)) {
+        this_cpu_inc(dev->stats->eagain);
+        return -EAGAIN;
+    }
+
+    ret = globalfifo_wait_space(dev, globalfifo_space_needed(dev, size),
+        globalfifo_nonblock(iocb));
+    if (ret > 0) {
+        mutex_unlock(&dev->wr_mutex);
+        return globalfifo_write_iter(iocb, from);
+    }
+    if (ret)
+        goto out;
+
+    head = dev->ctrl->head;
+    ret = globalfifo_write_locked(dev, from);
+    if (ret > 0) {
+        globalfifo_wake_readers(dev, head);
+        globalfifo_pass_on_write(dev);
+    }
+
+out:
+    mutex_unlock(&dev->wr_mutex);
+    return ret;
+}
+
+/*
+ * GLOBALFIFO_IOC_RECV_MMSG: block for the first entry only, then fill
+ * entries while data is queued. As with recvmmsg(), an error after some
+ * entries were filled just ends the batch.
+ */
+static long globalfifo_recv_mmsg(struct file *filp,
+    struct globalfifo_mmsg __user *arg)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+    struct globalfifo_msg __user *umsg = NULL;
+    struct globalfifo_mmsg mm;
+    struct globalfifo_msg msg;
+    struct iov_iter iter;
+    struct iovec iov;
+    unsigned int i = 0;
+    ssize_t ret = 0;
+
+    if (!(filp->f_mode & FMODE_READ))
+        return -EBADF;
+    if (copy_from_user(&mm, arg, sizeof(mm)))
+        return -EFAULT;
+    if (mm.vlen == 0 || mm.vlen > GLOBALFIFO_MMSG_MAX)
+        return -EINVAL;
+    umsg = u64_to_user_ptr(mm.msgs);
+
+    mutex_lock(&dev->rd_mutex);
+
+    /* the batches work on the single ring, whatever the mode is by now */
+    do {
+        if (dev->mode & (GLOBALFIFO_MODE_SPSC | GLOBALFIFO_MODE_SHARDED |
+            GLOBALFIFO_MODE_BROADCAST)) {
+            ret = -EINVAL;
+            goto out;
+        }
+        ret = globalfifo_wait_data(dev, filp->f_flags & O_NONBLOCK);
+    } while (ret > 0);
+    if (ret)
+        goto out;
+
+    for (i = 0; i < mm.vlen && globalfifo_len(dev) != 0; i++) {
+        if (copy_from_user(&msg, &umsg[i], sizeof(msg))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        iov.iov_base = u64_to_user_ptr(msg.buf);
+        iov.iov_len = msg.len;
+        iov_iter_init(&iter, ITER_DEST, &iov, 1, msg.len);
+        ret = globalfifo_read_locked(dev, &iter);
+        if (ret < 0)
+            break;
+        if (put_user((__u32)ret, &umsg[i].len)) {
+            ret = -EFAULT;
+            break;
         }
     }
 
-    if (size > GLOBALFIFO_SIZE - dev->current_len) {
-        size = GLOBALFIFO_SIZE - dev->current_len;
+    if (i) {
+        globalfifo_mark_empty(dev);
+        globalfifo_wake_writers(dev);
+        globalfifo_pass_on_read(dev);
     }
 
-    if (copy_from_user(dev->fifo + dev->current_len, buf, size)) {
-        printk(KERN_ERR "globalfifo copy user data to driver buffer failed\n");
-        ret = -EFAULT;
+out:
+    mutex_unlock(&dev->rd_mutex);
+    return i ? i : ret;
+}
+
+/*
+ * GLOBALFIFO_IOC_SEND_MMSG: block until the first entry fits, then queue
+ * entries while there is room. A stream entry that only partly fits is
+ * written partly and ends the batch.
+ */
+static long globalfifo_send_mmsg(struct file *filp,
+    struct globalfifo_mmsg __user *arg)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+    struct globalfifo_msg __user *umsg = NULL;
+    struct globalfifo_mmsg mm;
+    struct globalfifo_msg msg;
+    struct iov_iter iter;
+    struct iovec iov;
+    unsigned int head = 0;
+    size_t need = 0;
+    unsigned int i = 0;
+    ssize_t ret = 0;
+
+    if (!(filp->f_mode & FMODE_WRITE))
+        return -EBADF;
+    if (copy_from_user(&mm, arg, sizeof(mm)))
+        return -EFAULT;
+    if (mm.vlen == 0 || mm.vlen > GLOBALFIFO_MMSG_MAX)
+        return -EINVAL;
+    umsg = u64_to_user_ptr(mm.msgs);
+
+    mutex_lock(&dev->wr_mutex);
+
+    for (i = 0; i < mm.vlen; i++) {
+        if (copy_from_user(&msg, &umsg[i], sizeof(msg))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        need = globalfifo_space_needed(dev, msg.len);
+        if (i == 0) {
+            /* as in globalfifo_recv_mmsg() */
+            do {
+                if (dev->mode & (GLOBALFIFO_MODE_SPSC |
+                    GLOBALFIFO_MODE_SHARDED | GLOBALFIFO_MODE_BROADCAST)) {
+                    ret = -EINVAL;
+                    break;
+                }
+                need = globalfifo_space_needed(dev, msg.len);
+                ret = globalfifo_wait_space(dev, need,
+                    filp->f_flags & O_NONBLOCK);
+            } while (ret > 0);
+            if (ret)
+                break;
+            head = dev->ctrl->head;
+        } else if (dev->size - globalfifo_len(dev) < need) {
+            break;
+        }
+
+        iov.iov_base = u64_to_user_ptr(msg.buf);
+        iov.iov_len = msg.len;
+        iov_iter_init(&iter, ITER_SOURCE, &iov, 1, msg.len);
+        ret = globalfifo_write_locked(dev, &iter);
+        if (ret < 0)
+            break;
+        if (put_user((__u32)ret, &umsg[i].len)) {
+            ret = -EFAULT;
+            break;
+        }
+        if (ret < msg.len) {
+            i++;
+            break;
+        }
+    }
+
+    if (i) {
+        globalfifo_wake_readers(dev, head);
+        globalfifo_pass_on_write(dev);
+    }
+
+    mutex_unlock(&dev->wr_mutex);
+    return i ? i : ret;
+}
+
+static void globalfifo_vm_open(struct vm_area_struct *vma)
+{
+    struct globalfifo_dev *dev = vma->vm_private_data;
+
+    atomic_inc(&dev->nr_maps);
+}
+
+static void globalfifo_vm_close(struct vm_area_struct *vma)
+{
+    struct globalfifo_dev *dev = vma->vm_private_data;
+
+    atomic_dec(&dev->nr_maps);
+}
+
+static vm_fault_t globalfifo_vm_fault(struct vm_fault *vmf)
+{
+    struct globalfifo_dev *dev = vmf->vma->vm_private_data;
+    struct page *page = NULL;
+
+    if (vmf->pgoff == 0)
+        page = vmalloc_to_page(dev->ctrl);
+    else if (vmf->pgoff <= PAGE_ALIGN(dev->size) >> PAGE_SHIFT)
+        page = vmalloc_to_page(dev->fifo + ((vmf->pgoff - 1) << PAGE_SHIFT));
+    else
+        return VM_FAULT_SIGBUS;
+
+    get_page(page);
+    vmf->page = page;
+    return 0;
+}
+
+static const struct vm_operations_struct globalfifo_vm_ops = {
+    .open = globalfifo_vm_open,
+    .close = globalfifo_vm_close,
+    .fault = globalfifo_vm_fault,
+};
+
+static int globalfifo_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct globalfifo_dev *dev = globalfifo_file_dev(filp);
+    unsigned long nr_pages = 0;
+    int ret = 0;
+
+    if (!(filp->f_mode & FMODE_READ))
+        return -EACCES;
+
+    /* against RESIZE swapping the buffer and SET_MODE going broadcast */
+    mutex_lock(&dev->map_mutex);
+
+    nr_pages = 1 + (PAGE_ALIGN(dev->size) >> PAGE_SHIFT);
+    if (dev->mode & GLOBALFIFO_MODE_BROADCAST) {
+        ret = -EBUSY;
+    } else if (vma->vm_pgoff >= nr_pages ||
+        vma_pages(vma) > nr_pages - vma->vm_pgoff) {
+        ret = -EINVAL;
     } else {
-        dev->current_len += size;
-        printk(KERN_INFO "globalfifo write %lu bytes, current_len: %u\n",
-            size, dev->current_len);
-        wake_up_interruptible(&dev->r_wait);
-        ret = size;
+        vma->vm_ops = &globalfifo_vm_ops;
+        vma->vm_private_data = dev;
+        globalfifo_vm_open(vma);
     }
 
-exit1:
-    mutex_unlock(&dev->mutex);
-exit2:
+    mutex_unlock(&dev->map_mutex);
     return ret;
 }
 
 static const struct file_operations globalfifo_fops = {
     .owner = THIS_MODULE,
-    .read = globalfifo_read,
-    .write = globalfifo_write,
+    .read_iter = globalfifo_read_iter,
+    .write_iter = globalfifo_write_iter,
+    /* splice/sendfile move data between a pipe and the ring via *_iter */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
     .unlocked_ioctl = globalfifo_ioctl,
     .poll = globalfifo_poll,
+    .mmap = globalfifo_mmap,
     .open = globalfifo_open,
     .release = globalfifo_release,
 };
 
-static void globalfifo_setup_cdev(struct globalfifo_dev *dev, int index)
+static void globalfifo_free_ring(struct globalfifo_dev *dev)
+{
+    vfree(dev->fifo);
+    vfree(dev->ctrl);
+    dev->fifo = NULL;
+    dev->ctrl = NULL;
+}
+
+static void globalfifo_release_dev(struct kref *kref)
+{
+    struct globalfifo_dev *dev = container_of(kref, struct globalfifo_dev,
+        kref);
+
+    timer_delete_sync(&dev->rd_timer);
+    globalfifo_free_shards(dev);
+    globalfifo_free_ring(dev);
+    free_percpu(dev->stats);
+    kfree_rcu(dev, rcu);
+}
+
+static void globalfifo_put(struct globalfifo_dev *dev)
+{
+    kref_put(&dev->kref, globalfifo_release_dev);
+}
+
+/*
+ * Called by the first open(), so a device nobody has opened costs no
+ * more than its structure.
+ */
+static int globalfifo_alloc_ring(struct globalfifo_dev *dev)
+{
+    struct globalfifo_ring_ctrl *ctrl = NULL;
+    unsigned char *fifo = NULL;
+
+    /*
+     * vmalloc_user() memory is zeroed and may be mapped to user space,
+     * and being virtually contiguous it copes with multi-MiB FIFOs.
+     */
+    ctrl = vmalloc_user(PAGE_SIZE);
+    fifo = vmalloc_user(dev->size);
+    if (!ctrl || !fifo) {
+        vfree(fifo);
+        vfree(ctrl);
+        return -ENOMEM;
+    }
+
+    ctrl->size = dev->size;
+    dev->fifo = fifo;
+    /* statistics look at the ring without the mutex */
+    smp_store_release(&dev->ctrl, ctrl);
+    return 0;
+}
+
+static int globalfifo_stats_show(struct seq_file *s, void *unused)
+{
+    struct globalfifo_dev *dev = s->private;
+    struct globalfifo_stats st;
+
+    globalfifo_get_stats(dev, &st);
+
+    seq_printf(s, "size          %u\n", st.size);
+    seq_printf(s, "len           %u\n", st.len);
+    seq_printf(s, "high_water    %u\n", st.high_water);
+    seq_printf(s, "bytes_read    %llu\n", st.bytes_read);
+    seq_printf(s, "bytes_written %llu\n", st.bytes_written);
+    seq_printf(s, "reads         %llu\n", st.reads);
+    seq_printf(s, "writes        %llu\n", st.writes);
+    seq_printf(s, "r_waits       %llu\n", st.r_waits);
+    seq_printf(s, "w_waits       %llu\n", st.w_waits);
+    seq_printf(s, "r_wait_ns     %llu\n", st.r_wait_ns);
+    seq_printf(s, "w_wait_ns     %llu\n", st.w_wait_ns);
+    seq_printf(s, "eagain        %llu\n", st.eagain);
+    seq_printf(s, "polls         %llu\n", st.polls);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(globalfifo_stats);
+
+/* /sys/kernel/globalfifo/<field>: totals over all devices */
+#define GLOBALFIFO_SUM_ATTR(field)                                      \
+static ssize_t field##_show(struct kobject *kobj,                       \
+    struct kobj_attribute *attr, char *buf)                             \
+{                                                                       \
+    struct globalfifo_stats st;                                         \
+    struct globalfifo_dev *dev = NULL;                                  \
+    unsigned long i = 0;                                                \
+    u64 sum = 0;                                                        \
+                                                                        \
+    mutex_lock(&globalfifo_devs_mutex);                                 \
+    xa_for_each(&globalfifo_devs, i, dev) {                             \
+        globalfifo_get_stats(dev, &st);                                 \
+        sum += st.field;                                                \
+    }                                                                   \
+    mutex_unlock(&globalfifo_devs_mutex);                               \
+    return sprintf(buf, "%llu\n", sum);                                 \
+}                                                                       \
+static struct kobj_attribute field##_attr = __ATTR_RO(field)
+
+GLOBALFIFO_SUM_ATTR(bytes_read);
+GLOBALFIFO_SUM_ATTR(bytes_written);
+GLOBALFIFO_SUM_ATTR(reads);
+GLOBALFIFO_SUM_ATTR(writes);
+GLOBALFIFO_SUM_ATTR(r_waits);
+GLOBALFIFO_SUM_ATTR(w_waits);
+GLOBALFIFO_SUM_ATTR(eagain);
+
+static struct attribute *globalfifo_attrs[] = {
+    &bytes_read_attr.attr,
+    &bytes_written_attr.attr,
+    &reads_attr.attr,
+    &writes_attr.attr,
+    &r_waits_attr.attr,
+    &w_waits_attr.attr,
+    &eagain_attr.attr,
+    NULL,
+};
+
+static const struct attribute_group globalfifo_attr_group = {
+    .attrs = globalfifo_attrs,
+};
+
+/* statistics are diagnostics only, so failing to export them is not fatal */
+static void globalfifo_export_stats(void)
+{
+    globalfifo_kobj = kobject_create_and_add("globalfifo", kernel_kobj);
+    if (!globalfifo_kobj) {
+        printk(KERN_NOTICE "Error creating /sys/kernel/globalfifo\n");
+        return;
+    }
+    if (sysfs_create_group(globalfifo_kobj, &globalfifo_attr_group)) {
+        printk(KERN_NOTICE "Error adding globalfifo sysfs attributes\n");
+        kobject_put(globalfifo_kobj);
+        globalfifo_kobj = NULL;
+    }
+}
+
+/*
+ * A new FIFO of size bytes at the lowest free minor, its node made by
+ * udev through the class. The buffer waits for the first open().
+ */
+static int globalfifo_create(unsigned int size, u32 *minor)
+{
+    struct globalfifo_dev *dev = NULL;
+    struct device *node = NULL;
+    char name[24];
+    int ret = 0;
+
+    if (size == 0)
+        size = GLOBALFIFO_SIZE;
+    if (size > GLOBALFIFO_MAX_SIZE)
+        return -EINVAL;
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return -ENOMEM;
+
+    kref_init(&dev->kref);
+    dev->size = roundup_pow_of_two(size);
+    mutex_init(&dev->mutex);
+    mutex_init(&dev->map_mutex);
+    mutex_init(&dev->rd_mutex);
+    mutex_init(&dev->wr_mutex);
+    init_waitqueue_head(&dev->r_wait);
+    init_waitqueue_head(&dev->w_wait);
+    init_rwsem(&dev->shard_rwsem);
+    INIT_LIST_HEAD(&dev->subs);
+    dev->low_wmark = globalfifo_low_wmark;
+    dev->high_wmark = max(globalfifo_high_wmark, 1U);
+    dev->wmark_timeout_ms = globalfifo_wmark_timeout_ms;
+    timer_setup(&dev->rd_timer, globalfifo_rd_timeout, 0);
+
+    dev->stats = alloc_percpu(struct globalfifo_stats);
+    dev->cdev = cdev_alloc();
+    if (!dev->stats || !dev->cdev) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    dev->cdev->ops = &globalfifo_fops;
+    dev->cdev->owner = THIS_MODULE;
+
+    mutex_lock(&globalfifo_devs_mutex);
+
+    ret = xa_alloc(&globalfifo_devs, &dev->minor, dev,
+        XA_LIMIT(0, GLOBALFIFO_CTL_MINOR - 1), GFP_KERNEL);
+    if (ret)
+        goto fail_unlock;
+
+    ret = cdev_add(dev->cdev, MKDEV(globalfifo_major, dev->minor), 1);
+    if (ret)
+        goto fail_erase;
+
+    node = device_create(globalfifo_class, NULL,
+        MKDEV(globalfifo_major, dev->minor), NULL, "globalfifo%u",
+        dev->minor);
+    if (IS_ERR(node)) {
+        ret = PTR_ERR(node);
+        goto fail_cdev;
+    }
+
+    snprintf(name, sizeof(name), "globalfifo%u", dev->minor);
+    dev->debugfs = debugfs_create_dir(name, globalfifo_debugfs);
+    debugfs_create_file("stats", S_IRUGO, dev->debugfs, dev,
+        &globalfifo_stats_fops);
+
+    mutex_unlock(&globalfifo_devs_mutex);
+
+    *minor = dev->minor;
+    return 0;
+
+fail_cdev:
+    cdev_del(dev->cdev);
+    dev->cdev = NULL;
+fail_erase:
+    xa_erase(&globalfifo_devs, dev->minor);
+fail_unlock:
+    mutex_unlock(&globalfifo_devs_mutex);
+fail:
+    if (dev->cdev)
+        kobject_put(&dev->cdev->kobj);
+    globalfifo_put(dev);
+    return ret;
+}
+
+/*
+ * The device can no longer be opened, but files already open on it
+ * keep it until they are closed.
+ */
+static int globalfifo_destroy(unsigned long minor)
+{
+    struct globalfifo_dev *dev = NULL;
+
+    mutex_lock(&globalfifo_devs_mutex);
+    dev = xa_erase(&globalfifo_devs, minor);
+    if (dev) {
+        debugfs_remove_recursive(dev->debugfs);
+        device_destroy(globalfifo_class, MKDEV(globalfifo_major, minor));
+        cdev_del(dev->cdev);
+    }
+    mutex_unlock(&globalfifo_devs_mutex);
+
+    if (!dev)
+        return -ENXIO;
+
+    globalfifo_put(dev);
+    return 0;
+}
+
+static void globalfifo_destroy_all(void)
 {
-    int err;
-    int devno = MKDEV(globalfifo_major, index);
+    struct globalfifo_dev *dev = NULL;
+    unsigned long i = 0;
 
-    cdev_init(&dev->cdev, &globalfifo_fops);
-    dev->cdev.owner = THIS_MODULE;
-    err = cdev_add(&dev->cdev, devno, 1);
-    if (err) {
-        printk(KERN_NOTICE "Error %d adding globalfifo%d", err, index);
+    xa_for_each(&globalfifo_devs, i, dev)
+        globalfifo_destroy(i);
+}
+
+static long globalfifo_ctl_ioctl(struct file *filp,
+    unsigned int cmd, unsigned long arg)
+{
+    struct globalfifo_create cr;
+    int ret = 0;
+
+    switch (cmd) {
+    case GLOBALFIFO_IOC_CREATE:
+        if (copy_from_user(&cr, (void __user *)arg, sizeof(cr)))
+            return -EFAULT;
+        ret = globalfifo_create(cr.size, &cr.minor);
+        if (ret)
+            return ret;
+        if (copy_to_user((void __user *)arg, &cr, sizeof(cr))) {
+            globalfifo_destroy(cr.minor);
+            return -EFAULT;
+        }
+        break;
+
+    case GLOBALFIFO_IOC_DESTROY:
+        return globalfifo_destroy(arg);
+
+    case GLOBALFIFO_IOC_GET_READY:
+        return globalfifo_get_ready((void __user *)arg);
+
+    default:
+        return -EINVAL;
     }
+
+    return 0;
 }
 
+static const struct file_operations globalfifo_ctl_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = globalfifo_ctl_ioctl,
+};
+
 static int __init globalfifo_init(void)
 {
     int ret = 0;
     dev_t devno = MKDEV(globalfifo_major, 0);
+    struct device *node = NULL;
+    u32 minor = 0;
     int i = 0;
 
+    if (globalfifo_nr_devs > GLOBALFIFO_MAX_DEVS) {
+        printk(KERN_ERR "globalfifo_nr_devs must be at most %d\n",
+            GLOBALFIFO_MAX_DEVS);
+        return -EINVAL;
+    }
+
     if (globalfifo_major) {
         ret = register_chrdev_region(devno,
-            GLOBALFIFO_DEV_NUM, "globalfifo");
+            GLOBALFIFO_MAX_MINORS, "globalfifo");
     } else {
         ret = alloc_chrdev_region(&devno, 0,
-            GLOBALFIFO_DEV_NUM, "globalfifo");
+            GLOBALFIFO_MAX_MINORS, "globalfifo");
         globalfifo_major = MAJOR(devno);
     }
     if (ret < 0)
         return ret;
 
-    globalfifo_devp = kzalloc(
-        sizeof(struct globalfifo_dev) * GLOBALFIFO_DEV_NUM, GFP_KERNEL);
-    if (!globalfifo_devp) {
-        ret = -ENOMEM;
-        goto fail_malloc;
+    globalfifo_class = globalfifo_class_create("globalfifo");
+    if (IS_ERR(globalfifo_class)) {
+        ret = PTR_ERR(globalfifo_class);
+        goto fail_class;
+    }
+
+    cdev_init(&globalfifo_ctl_cdev, &globalfifo_ctl_fops);
+    globalfifo_ctl_cdev.owner = THIS_MODULE;
+    ret = cdev_add(&globalfifo_ctl_cdev,
+        MKDEV(globalfifo_major, GLOBALFIFO_CTL_MINOR), 1);
+    if (ret)
+        goto fail_ctl;
+
+    node = device_create(globalfifo_class, NULL,
+        MKDEV(globalfifo_major, GLOBALFIFO_CTL_MINOR), NULL,
+        "globalfifo_ctl");
+    if (IS_ERR(node)) {
+        ret = PTR_ERR(node);
+        goto fail_node;
     }
 
-    for (i = 0; i < GLOBALFIFO_DEV_NUM; i++) {
-        mutex_init(&globalfifo_devp[i].mutex);
-        init_waitqueue_head(&globalfifo_devp[i].r_wait);
-        init_waitqueue_head(&globalfifo_devp[i].w_wait);
-        globalfifo_setup_cdev(&globalfifo_devp[i], i);
+    /* statistics are diagnostics only, so a missing directory is not fatal */
+    globalfifo_debugfs = debugfs_create_dir("globalfifo", NULL);
+
+    for (i = 0; i < globalfifo_nr_devs; i++) {
+        ret = globalfifo_create(globalfifo_size[i], &minor);
+        if (ret) {
+            printk(KERN_ERR "Error %d creating globalfifo%d of %u bytes\n",
+                ret, i, globalfifo_size[i]);
+            goto fail_devs;
+        }
     }
 
+    globalfifo_export_stats();
+
     return 0;
 
-fail_malloc:
-    unregister_chrdev_region(devno, GLOBALFIFO_DEV_NUM);
+fail_devs:
+    globalfifo_destroy_all();
+    debugfs_remove_recursive(globalfifo_debugfs);
+    device_destroy(globalfifo_class,
+        MKDEV(globalfifo_major, GLOBALFIFO_CTL_MINOR));
+fail_node:
+    cdev_del(&globalfifo_ctl_cdev);
+fail_ctl:
+    class_destroy(globalfifo_class);
+fail_class:
+    unregister_chrdev_region(devno, GLOBALFIFO_MAX_MINORS);
     return ret;
 }
 module_init(globalfifo_init);
 
 static void __exit globalfifo_exit(void)
 {
-    int i = 0;
+    kobject_put(globalfifo_kobj);
 
-    for (i = 0; i < GLOBALFIFO_DEV_NUM; i++)
-        cdev_del(&globalfifo_devp[i].cdev);
-    kfree(globalfifo_devp);
-    unregister_chrdev_region(MKDEV(globalfifo_major, 0), GLOBALFIFO_DEV_NUM);
+    /* open files pin the module, so every device goes here */
+    globalfifo_destroy_all();
+    xa_destroy(&globalfifo_devs);
+    debugfs_remove_recursive(globalfifo_debugfs);
+
+    device_destroy(globalfifo_class,
+        MKDEV(globalfifo_major, GLOBALFIFO_CTL_MINOR));
+    cdev_del(&globalfifo_ctl_cdev);
+    class_destroy(globalfifo_class);
+    unregister_chrdev_region(MKDEV(globalfifo_major, 0),
+        GLOBALFIFO_MAX_MINORS);
 }
 module_exit(globalfifo_exit);
 
 MODULE_AUTHOR("Yang <yangtzhou@qq.com>");
 MODULE_LICENSE("GPL v2");
-
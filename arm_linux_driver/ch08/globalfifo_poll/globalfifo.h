@@ -1,7 +1,223 @@
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define GLOBALFIFO_DEV_NUM  8
 
+/* minors 0 to GLOBALFIFO_MAX_MINORS - 2 are FIFOs, the last the control */
+#define GLOBALFIFO_MAX_MINORS   65536
+
 #define GLOBALFIFO_TYPE         'G'
 
 #define GLOBALFIFO_IOC_CLEAR    _IO(GLOBALFIFO_TYPE, 1)
+#define GLOBALFIFO_IOC_SET_MODE _IO(GLOBALFIFO_TYPE, 2)
+#define GLOBALFIFO_IOC_GET_MODE _IO(GLOBALFIFO_TYPE, 3)
+
+/*
+ * GLOBALFIFO_IOC_SET_MODE flags, only accepted while the caller's file
+ * is the only one open on the device.
+ *
+ * GLOBALFIFO_MODE_SPSC: at most one reader and one writer may open the
+ * device, and read/write/poll run without the device mutexes. Each side
+ * must be driven by a single thread.
+ */
+#define GLOBALFIFO_MODE_SPSC    0x1
+
+/*
+ * GLOBALFIFO_MODE_RECORD: each write() queues one record and each
+ * read() returns exactly one, failing with EMSGSIZE (and leaving the
+ * record queued) if the buffer is too small. Records are stored as a
+ * native-endian __u32 length followed by the payload, without padding,
+ * and may wrap around the end of the ring. The FIFO must be empty to
+ * switch in or out of record mode, and it cannot be combined with SPSC.
+ */
+#define GLOBALFIFO_MODE_RECORD  0x2
+#define GLOBALFIFO_RECORD_HDR   sizeof(__u32)
+
+/*
+ * GLOBALFIFO_MODE_SHARDED: every CPU gets its own sub-ring of the FIFO's
+ * size, and a write() is appended whole to the sub-ring of the CPU it
+ * runs on under that sub-ring's lock only, failing with EMSGSIZE if it
+ * can never fit. Readers merge the sub-rings into one byte stream;
+ * bytes of one write are never interleaved with another. Without
+ * GLOBALFIFO_MODE_ORDERED, writes from a thread that migrates between
+ * CPUs may be read out of order. With it, every write is stamped from a
+ * device-wide sequence and reads follow the stamps.
+ *
+ * The FIFO must be empty to switch in or out, it cannot be combined with
+ * SPSC or record mode, and resize and the batch ioctls are refused while
+ * it is set. Watermarks do not apply.
+ */
+#define GLOBALFIFO_MODE_SHARDED 0x4
+#define GLOBALFIFO_MODE_ORDERED 0x8
+
+/*
+ * GLOBALFIFO_MODE_BROADCAST: every file opened for reading subscribes
+ * and reads every byte written after it opened, from a position of its
+ * own, instead of readers taking turns at one stream. Data written
+ * while nobody is subscribed is dropped. Writers wait for the slowest
+ * subscriber, unless GLOBALFIFO_MODE_OVERRUN is set too: then writes
+ * never wait, a write() takes at most the FIFO's size, and the oldest
+ * bytes are overwritten. A subscriber that falls a whole FIFO behind
+ * gets EOVERFLOW from its next read() and continues from the oldest
+ * byte still held.
+ *
+ * The FIFO must be empty to switch in or out, it cannot be combined
+ * with SPSC, record or sharded mode, and resize, mmap and the batch
+ * ioctls are refused while it is set. The high watermark does not
+ * apply; GET_READY and the eventfd go by the slowest subscriber, or in
+ * overrun mode by whether anything is held.
+ */
+#define GLOBALFIFO_MODE_BROADCAST   0x10
+#define GLOBALFIFO_MODE_OVERRUN     0x20
+
+#define GLOBALFIFO_IOC_RING_WAKE    _IO(GLOBALFIFO_TYPE, 4)
+
+/*
+ * Resize the FIFO to arg bytes (rounded up to a power of two), keeping
+ * queued data. Fails with EBUSY while the ring is mapped or the device
+ * is in SPSC mode, and with ENOSPC if the queued data would not fit.
+ */
+#define GLOBALFIFO_IOC_RESIZE       _IO(GLOBALFIFO_TYPE, 5)
+#define GLOBALFIFO_IOC_GET_SIZE     _IO(GLOBALFIFO_TYPE, 6)
+
+#define GLOBALFIFO_MAX_SIZE         (1U << 28)
+
+/*
+ * mmap layout: page 0 holds struct globalfifo_ring_ctrl and the data
+ * area starts at page 1. head and tail run freely; the byte at index i
+ * lives at data[i & (size - 1)].
+ *
+ * A mapping consumer reads head with acquire, copies data out, publishes
+ * tail with release and, after a full barrier, issues
+ * GLOBALFIFO_IOC_RING_WAKE if writer_waiting is set. It must be the only
+ * consumer of the device.
+ */
+struct globalfifo_ring_ctrl {
+    __u32 head;
+    __u32 reserved0[15];
+    __u32 tail;
+    __u32 reserved1[15];
+    __u32 size;
+    __u32 writer_waiting;
+};
+
+/*
+ * Counters since load or the last GLOBALFIFO_IOC_RESET_STATS. Wait times
+ * are in nanoseconds; len and size are sampled at the time of the call.
+ * The same numbers are in debugfs under globalfifo/globalfifoN.
+ */
+struct globalfifo_stats {
+    __u64 bytes_read;
+    __u64 bytes_written;
+    __u64 reads;
+    __u64 writes;
+    __u64 r_waits;
+    __u64 w_waits;
+    __u64 r_wait_ns;
+    __u64 w_wait_ns;
+    __u64 eagain;
+    __u64 polls;
+    __u32 len;
+    __u32 size;
+    __u32 high_water;
+    __u32 reserved;
+};
+
+#define GLOBALFIFO_IOC_GET_STATS    \
+    _IOR(GLOBALFIFO_TYPE, 7, struct globalfifo_stats)
+#define GLOBALFIFO_IOC_RESET_STATS  _IO(GLOBALFIFO_TYPE, 8)
+
+/*
+ * Wakeup watermarks, in bytes of fill level. Readers sleeping on an
+ * empty FIFO are woken, and POLLIN reported, once len reaches high or
+ * timeout_ms has passed since the FIFO became non-empty (0 disables the
+ * timeout). Writers sleeping on a full FIFO are woken, and POLLOUT
+ * reported, once len drops to low; values of size or more mean "any free
+ * space". The watermarks only gate wakeups: a read or write that finds
+ * data or space still transfers what is there.
+ */
+struct globalfifo_wmark {
+    __u32 low;
+    __u32 high;
+    __u32 timeout_ms;
+};
+
+#define GLOBALFIFO_IOC_SET_WMARK    \
+    _IOW(GLOBALFIFO_TYPE, 9, struct globalfifo_wmark)
+#define GLOBALFIFO_IOC_GET_WMARK    \
+    _IOR(GLOBALFIFO_TYPE, 10, struct globalfifo_wmark)
+
+/*
+ * Batched transfer in the spirit of recvmmsg()/sendmmsg(). msgs points
+ * to vlen struct globalfifo_msg; on return len of every transferred
+ * entry holds the bytes copied. An entry is one record in record mode
+ * and up to len bytes otherwise. The call sleeps (unless O_NONBLOCK)
+ * only until the first entry can move, transfers as many entries as it
+ * can under a single mutex acquisition and returns how many it did.
+ * Not available in SPSC mode.
+ */
+struct globalfifo_msg {
+    __u64 buf;
+    __u32 len;
+    __u32 reserved;
+};
+
+struct globalfifo_mmsg {
+    __u64 msgs;
+    __u32 vlen;
+    __u32 reserved;
+};
+
+#define GLOBALFIFO_MMSG_MAX         1024
+
+#define GLOBALFIFO_IOC_RECV_MMSG    \
+    _IOW(GLOBALFIFO_TYPE, 11, struct globalfifo_mmsg)
+#define GLOBALFIFO_IOC_SEND_MMSG    \
+    _IOW(GLOBALFIFO_TYPE, 12, struct globalfifo_mmsg)
+
+/*
+ * Readiness of many devices without polling each one. SET_EVENTFD
+ * attaches the eventfd whose descriptor is arg to this device, or
+ * detaches it with -1; several devices may share one eventfd. It is
+ * signalled when the device goes from empty to holding data, edge
+ * triggered as with EPOLLET, and stays attached until replaced, detached
+ * or the file that attached it is closed.
+ *
+ * GET_READY sets bit i % 64 of the i / 64th __u64 at mask for each
+ * globalfifo<i> holding data, up to nbits devices, and returns how many
+ * it set; watermarks do not apply. The edge is rearmed by the read(),
+ * or batch ioctl, that empties the device, or by a GET_READY that finds
+ * it empty, not by a consumer working through the mapping. So read the
+ * eventfd, call GET_READY and read each device it reports until EAGAIN.
+ * Bit i stands for minor i, so nbits need not exceed the highest minor
+ * in use plus one, and at most GLOBALFIFO_MAX_MINORS are looked at.
+ */
+struct globalfifo_ready {
+    __u64 mask;
+    __u32 nbits;
+    __u32 reserved;
+};
+
+#define GLOBALFIFO_IOC_SET_EVENTFD  _IO(GLOBALFIFO_TYPE, 13)
+#define GLOBALFIFO_IOC_GET_READY    \
+    _IOW(GLOBALFIFO_TYPE, 14, struct globalfifo_ready)
+
+/*
+ * Ioctls of /dev/globalfifo_ctl, which also takes GET_READY. The module
+ * creates globalfifo_nr_devs FIFOs at load; more are made on demand.
+ *
+ * CREATE makes a FIFO of size bytes, 0 for the default, at the lowest
+ * free minor and returns the minor; udev then creates
+ * /dev/globalfifo<minor>. The buffer is only allocated when the FIFO is
+ * first opened. DESTROY removes the FIFO whose minor is arg. It can no
+ * longer be opened, but files already open on it keep working until
+ * they are closed.
+ */
+struct globalfifo_create {
+    __u32 size;
+    __u32 minor;    /* out */
+};
+
+#define GLOBALFIFO_IOC_CREATE       \
+    _IOWR(GLOBALFIFO_TYPE, 15, struct globalfifo_create)
+#define GLOBALFIFO_IOC_DESTROY      _IO(GLOBALFIFO_TYPE, 16)
@@ -0,0 +1,98 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM globalfifo
+
+#if !defined(_GLOBALFIFO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GLOBALFIFO_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Hot-path events for globalfifo. They cost a patched-out branch while
+ * disabled; enable them under /sys/kernel/tracing/events/globalfifo.
+ */
+DECLARE_EVENT_CLASS(globalfifo_io,
+
+    TP_PROTO(unsigned int minor, size_t count, unsigned int len),
+
+    TP_ARGS(minor, count, len),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(unsigned int, len)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->len = len;
+    ),
+
+    TP_printk("globalfifo%u count=%zu len=%u",
+        __entry->minor, __entry->count, __entry->len)
+);
+
+DEFINE_EVENT(globalfifo_io, globalfifo_read,
+    TP_PROTO(unsigned int minor, size_t count, unsigned int len),
+    TP_ARGS(minor, count, len)
+);
+
+DEFINE_EVENT(globalfifo_io, globalfifo_write,
+    TP_PROTO(unsigned int minor, size_t count, unsigned int len),
+    TP_ARGS(minor, count, len)
+);
+
+DECLARE_EVENT_CLASS(globalfifo_waitq,
+
+    TP_PROTO(unsigned int minor, bool writer),
+
+    TP_ARGS(minor, writer),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(bool, writer)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->writer = writer;
+    ),
+
+    TP_printk("globalfifo%u %s", __entry->minor,
+        __entry->writer ? "writer" : "reader")
+);
+
+DEFINE_EVENT(globalfifo_waitq, globalfifo_wait,
+    TP_PROTO(unsigned int minor, bool writer),
+    TP_ARGS(minor, writer)
+);
+
+DEFINE_EVENT(globalfifo_waitq, globalfifo_wakeup,
+    TP_PROTO(unsigned int minor, bool writer),
+    TP_ARGS(minor, writer)
+);
+
+TRACE_EVENT(globalfifo_clear,
+
+    TP_PROTO(unsigned int minor),
+
+    TP_ARGS(minor),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+    ),
+
+    TP_printk("globalfifo%u", __entry->minor)
+);
+#endif /* _GLOBALFIFO_TRACE_H */
+
+/* this part must be outside the header guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE globalfifo_trace
+#include <trace/define_trace.h>
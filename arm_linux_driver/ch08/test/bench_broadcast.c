@@ -0,0 +1,254 @@
+/*
+ * Writer throughput and subscriber lag in GLOBALFIFO_MODE_BROADCAST on
+ * /dev/globalfifo0, with 1, 2, 4, ... 32 subscribers.
+ *
+ * A writer thread writes 64-byte messages, each starting with its
+ * CLOCK_MONOTONIC stamp, for the given number of seconds. Every
+ * subscriber is a thread with its own fd reading the whole stream and
+ * recording how long each message took to reach it. Each count is run
+ * twice:
+ *
+ *   block    the writer waits for the slowest subscriber
+ *   overrun  with GLOBALFIFO_MODE_OVERRUN, the writer never waits and
+ *            subscribers that fall behind lose data
+ *
+ * The writer's MiB/s, the median subscriber's median lag, the worst
+ * subscriber's p99 lag and the EOVERFLOWs seen are reported.
+ *
+ * usage: bench_broadcast [seconds] [fifo_size]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define MSG_LEN     64
+#define MAX_SUBS    32
+#define MAX_SAMPLES (1 << 20)
+
+enum { POLICY_BLOCK, POLICY_OVERRUN, NR_POLICIES };
+
+static const char *policy_names[NR_POLICIES] = { "block", "overrun" };
+
+struct sub {
+    pthread_t tid;
+    int fd;
+    long overruns;
+    long n;
+    uint64_t *lat;
+};
+
+struct pub {
+    int fd;
+    long bytes;
+};
+
+static volatile int writing;
+static volatile int written;
+static double secs = 2;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *writer(void *arg)
+{
+    struct pub *p = arg;
+    char msg[MSG_LEN];
+    uint64_t stamp = 0;
+    ssize_t n = 0;
+    size_t off = 0;
+
+    memset(msg, 0, sizeof(msg));
+    while (writing) {
+        stamp = now_ns();
+        memcpy(msg, &stamp, sizeof(stamp));
+        /* a short write leaves the rest of the message to go next */
+        for (off = 0; off < MSG_LEN; off += n) {
+            n = write(p->fd, msg + off, MSG_LEN - off);
+            if (n < 0) {
+                printf("write failed: %s\n", strerror(errno));
+                return NULL;
+            }
+        }
+        p->bytes += MSG_LEN;
+    }
+
+    return NULL;
+}
+
+/* reads until the writer is done and nothing is left */
+static void *subscriber(void *arg)
+{
+    struct sub *s = arg;
+    struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+    char buf[MSG_LEN * 64 + MSG_LEN];
+    uint64_t stamp = 0;
+    uint64_t t = 0;
+    size_t have = 0;
+    size_t i = 0;
+    ssize_t n = 0;
+
+    for (;;) {
+        n = read(s->fd, buf + have, sizeof(buf) - have);
+        if (n < 0 && errno == EOVERFLOW) {
+            /* the stream picks up again at a message boundary */
+            s->overruns++;
+            have = 0;
+            continue;
+        }
+        /* EAGAIN may only mean another subscriber held the lock */
+        if (n < 0 && errno == EAGAIN) {
+            if (poll(&pfd, 1, written ? 0 : 10) == 0 && written)
+                break;
+            continue;
+        }
+        if (n <= 0)
+            break;
+
+        t = now_ns();
+        have += n;
+        for (i = 0; i + MSG_LEN <= have; i += MSG_LEN) {
+            memcpy(&stamp, buf + i, sizeof(stamp));
+            if (s->n < MAX_SAMPLES)
+                s->lat[s->n++] = t - stamp;
+        }
+        memmove(buf, buf + i, have - i);
+        have -= i;
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run(int wfd, struct sub *subs, int nr, int policy)
+{
+    struct pub w = { wfd, 0 };
+    uint64_t p50[MAX_SUBS];
+    pthread_t wtid;
+    long overruns = 0;
+    double t = 0;
+    uint64_t worst = 0;
+    int got = 0;
+    int i = 0;
+
+    ioctl(wfd, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(wfd, GLOBALFIFO_IOC_SET_MODE, GLOBALFIFO_MODE_BROADCAST |
+        (policy == POLICY_OVERRUN ? GLOBALFIFO_MODE_OVERRUN : 0))) {
+        printf("SET_MODE failed: %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < nr; i++) {
+        subs[i].fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+        subs[i].n = subs[i].overruns = 0;
+        if (subs[i].fd < 0) {
+            printf("open %s failed\n", DEV_NAME);
+            nr = i;
+            break;
+        }
+    }
+
+    written = 0;
+    writing = 1;
+    for (i = 0; i < nr; i++)
+        pthread_create(&subs[i].tid, NULL, subscriber, &subs[i]);
+    t = now_ns();
+    pthread_create(&wtid, NULL, writer, &w);
+    usleep(secs * 1e6);
+    writing = 0;
+    pthread_join(wtid, NULL);
+    t = (now_ns() - t) / 1e9;
+    written = 1;
+
+    for (i = 0; i < nr; i++) {
+        pthread_join(subs[i].tid, NULL);
+        close(subs[i].fd);
+        overruns += subs[i].overruns;
+        if (subs[i].n == 0)
+            continue;
+        qsort(subs[i].lat, subs[i].n, sizeof(uint64_t), cmp_u64);
+        p50[got++] = subs[i].lat[subs[i].n / 2];
+        if (subs[i].lat[subs[i].n * 99 / 100] > worst)
+            worst = subs[i].lat[subs[i].n * 99 / 100];
+    }
+    qsort(p50, got, sizeof(uint64_t), cmp_u64);
+
+    printf("%5d %8s %12.1f %12.1f %12.1f %10ld\n", nr, policy_names[policy],
+        w.bytes / t / (1 << 20), got ? p50[got / 2] / 1e3 : 0, worst / 1e3,
+        overruns);
+
+    /* overrun mode keeps the last FIFO's worth, so empty it to switch */
+    ioctl(wfd, GLOBALFIFO_IOC_CLEAR);
+    ioctl(wfd, GLOBALFIFO_IOC_SET_MODE, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct sub subs[MAX_SUBS];
+    long size = argc > 2 ? atol(argv[2]) : 65536;
+    int policy = 0;
+    int wfd = -1;
+    int nr = 0;
+    int i = 0;
+
+    if (argc > 1)
+        secs = atof(argv[1]);
+    if (secs <= 0 || size < MSG_LEN) {
+        printf("usage: %s [seconds] [fifo_size]\n", argv[0]);
+        return -1;
+    }
+
+    /* write-only, so it is no subscriber itself */
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(wfd, GLOBALFIFO_IOC_SET_MODE, 0);
+    ioctl(wfd, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(wfd, GLOBALFIFO_IOC_RESIZE, size))
+        printf("RESIZE to %ld failed: %s\n", size, strerror(errno));
+
+    for (i = 0; i < MAX_SUBS; i++) {
+        subs[i].lat = calloc(MAX_SAMPLES, sizeof(uint64_t));
+        if (!subs[i].lat)
+            return -1;
+    }
+
+    printf("%d byte messages, %.1f s per run, %d byte FIFO\n", MSG_LEN,
+        secs, (int)ioctl(wfd, GLOBALFIFO_IOC_GET_SIZE));
+    printf("%5s %8s %12s %12s %12s %10s\n", "subs", "policy", "write MiB/s",
+        "p50 lag us", "worst p99 us", "overruns");
+
+    for (nr = 1; nr <= MAX_SUBS; nr *= 2) {
+        for (policy = 0; policy < NR_POLICIES; policy++)
+            run(wfd, subs, nr, policy);
+    }
+
+    for (i = 0; i < MAX_SUBS; i++)
+        free(subs[i].lat);
+    close(wfd);
+    return 0;
+}
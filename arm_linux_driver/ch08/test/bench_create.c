@@ -0,0 +1,246 @@
+/*
+ * Creating many FIFOs through /dev/globalfifo_ctl: create, open and
+ * destroy latency, and the memory an idle FIFO costs.
+ *
+ * count FIFOs are created with GLOBALFIFO_IOC_CREATE, then each is
+ * opened and closed once, which allocates its ring, and opened again,
+ * then all are destroyed. /proc/meminfo is read before and after each
+ * step, giving the memory per FIFO before its first open and after it.
+ * Reopen latency is shown for the first and the last thousand FIFOs
+ * created, so a lookup that slows with the number of devices shows up.
+ *
+ * Nodes come from udev; if one has not appeared after "udevadm settle"
+ * it is made with mknod(), and removed again after DESTROY, so run this
+ * as root.
+ *
+ * usage: bench_create [count] [size]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define CTL_NAME    "/dev/globalfifo_ctl"
+#define WINDOW      1000
+
+struct meminfo {
+    long free;
+    long slab;
+    long percpu;
+    long vmalloc;
+};
+
+static long count = 10000;
+static unsigned int major_nr;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void read_meminfo(struct meminfo *m)
+{
+    char line[128];
+    FILE *fp = NULL;
+    long v = 0;
+
+    memset(m, 0, sizeof(*m));
+    fp = fopen("/proc/meminfo", "r");
+    if (!fp)
+        return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemFree: %ld", &v) == 1)
+            m->free = v;
+        else if (sscanf(line, "Slab: %ld", &v) == 1)
+            m->slab = v;
+        else if (sscanf(line, "Percpu: %ld", &v) == 1)
+            m->percpu = v;
+        else if (sscanf(line, "VmallocUsed: %ld", &v) == 1)
+            m->vmalloc = v;
+    }
+    fclose(fp);
+}
+
+/* KiB per FIFO that went from before to after, over n FIFOs */
+static void print_mem(const char *what, struct meminfo *before,
+    struct meminfo *after, long n)
+{
+    if (n == 0)
+        return;
+    printf("%-22s %10.2f %10.2f %10.2f %10.2f\n", what,
+        (double)(before->free - after->free) / n,
+        (double)(after->slab - before->slab) / n,
+        (double)(after->percpu - before->percpu) / n,
+        (double)(after->vmalloc - before->vmalloc) / n);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_lat(const char *what, uint64_t *lat, long n)
+{
+    if (n == 0)
+        return;
+    qsort(lat, n, sizeof(*lat), cmp_u64);
+    printf("%-22s %10.1f %10.1f %10.1f\n", what, lat[n / 2] / 1e3,
+        lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+}
+
+static void fifo_name(char *name, unsigned int minor)
+{
+    sprintf(name, "/dev/globalfifo%u", minor);
+}
+
+/* open the node, making it if udev has not and setting *made then */
+static int open_fifo(unsigned int minor, uint64_t *ns, char *made)
+{
+    char name[32];
+    uint64_t t = 0;
+    int fd = -1;
+
+    fifo_name(name, minor);
+    t = now_ns();
+    fd = open(name, O_RDWR | O_NONBLOCK);
+    *ns = now_ns() - t;
+    if (fd >= 0 || errno != ENOENT)
+        return fd;
+
+    if (mknod(name, S_IFCHR | 0600, makedev(major_nr, minor)))
+        return -1;
+    *made = 1;
+    t = now_ns();
+    fd = open(name, O_RDWR | O_NONBLOCK);
+    *ns = now_ns() - t;
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    struct globalfifo_create cr;
+    struct meminfo m[4];
+    struct stat st;
+    unsigned int *minors = NULL;
+    char *nodes = NULL;
+    char name[32];
+    uint64_t *lat = NULL;
+    uint64_t *reopen = NULL;
+    unsigned int size = 0;
+    uint64_t t = 0;
+    long made = 0;
+    long opened = 0;
+    long i = 0;
+    int ctl = -1;
+    int fd = -1;
+
+    if (argc > 1)
+        count = atol(argv[1]);
+    if (argc > 2)
+        size = atoi(argv[2]);
+    if (count < 1 || count > GLOBALFIFO_MAX_MINORS - 1) {
+        printf("usage: %s [count] [size]\n", argv[0]);
+        return -1;
+    }
+
+    ctl = open(CTL_NAME, O_RDWR);
+    minors = calloc(count, sizeof(*minors));
+    lat = calloc(count, sizeof(*lat));
+    reopen = calloc(count, sizeof(*reopen));
+    nodes = calloc(count, sizeof(*nodes));
+    if (ctl < 0 || !minors || !lat || !reopen || !nodes) {
+        printf("open %s failed\n", CTL_NAME);
+        return -1;
+    }
+    fstat(ctl, &st);
+    major_nr = major(st.st_rdev);
+
+    printf("%ld FIFOs of %u bytes\n", count, size);
+
+    read_meminfo(&m[0]);
+    for (made = 0; made < count; made++) {
+        memset(&cr, 0, sizeof(cr));
+        cr.size = size;
+        t = now_ns();
+        if (ioctl(ctl, GLOBALFIFO_IOC_CREATE, &cr)) {
+            printf("CREATE failed after %ld: %s\n", made, strerror(errno));
+            break;
+        }
+        lat[made] = now_ns() - t;
+        minors[made] = cr.minor;
+    }
+    if (system("udevadm settle >/dev/null 2>&1"))
+        printf("udevadm settle failed, missing nodes are made here\n");
+    read_meminfo(&m[1]);
+
+    printf("%-22s %10s %10s %10s\n", "", "p50 us", "p99 us", "max us");
+    print_lat("create", lat, made);
+
+    for (opened = 0; opened < made; opened++) {
+        fd = open_fifo(minors[opened], &lat[opened], &nodes[opened]);
+        if (fd < 0) {
+            printf("open globalfifo%u failed: %s\n", minors[opened],
+                strerror(errno));
+            break;
+        }
+        close(fd);
+    }
+    read_meminfo(&m[2]);
+
+    for (i = 0; i < opened; i++) {
+        fd = open_fifo(minors[i], &reopen[i], &nodes[i]);
+        if (fd >= 0)
+            close(fd);
+    }
+    print_lat("first open", lat, opened);
+    if (opened > 2 * WINDOW) {
+        print_lat("reopen, first 1000", reopen, WINDOW);
+        print_lat("reopen, last 1000", reopen + opened - WINDOW, WINDOW);
+    } else {
+        print_lat("reopen", reopen, opened);
+    }
+
+    for (i = 0; i < made; i++) {
+        t = now_ns();
+        if (ioctl(ctl, GLOBALFIFO_IOC_DESTROY, minors[i]))
+            printf("DESTROY %u failed: %s\n", minors[i], strerror(errno));
+        lat[i] = now_ns() - t;
+    }
+    /* udev removes its own nodes, but not the ones made here */
+    for (i = 0; i < made; i++) {
+        fifo_name(name, minors[i]);
+        if (nodes[i] && unlink(name))
+            printf("unlink %s failed: %s\n", name, strerror(errno));
+    }
+    print_lat("destroy", lat, made);
+    read_meminfo(&m[3]);
+
+    printf("\n%-22s %10s %10s %10s %10s\n", "KiB per FIFO", "MemFree",
+        "Slab", "Percpu", "Vmalloc");
+    print_mem("idle, never opened", &m[0], &m[1], made);
+    print_mem("after first open", &m[0], &m[2], made);
+    print_mem("left after destroy", &m[0], &m[3], made);
+
+    close(ctl);
+    free(nodes);
+    free(reopen);
+    free(lat);
+    free(minors);
+    return 0;
+}
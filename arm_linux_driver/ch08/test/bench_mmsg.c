@@ -0,0 +1,172 @@
+/*
+ * Per-message cost of GLOBALFIFO_IOC_RECV_MMSG/SEND_MMSG against plain
+ * read()/write(), for MSG_LEN byte records in record mode.
+ *
+ * A producer thread sends and the main thread receives the same number
+ * of records, both sides using the same batch size. Batch size 0 stands
+ * for plain read()/write().
+ *
+ * usage: bench_mmsg [records]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define FIFO_LEN    65536
+#define MSG_LEN     64
+#define MAX_BATCH   256
+
+struct side {
+    int fd;
+    int batch;
+    long records;
+    long calls;
+    char bufs[MAX_BATCH][MSG_LEN];
+    struct globalfifo_msg msgs[MAX_BATCH];
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* move up to want records, returns how many went or -1 */
+static long xfer(struct side *s, long want, int do_send)
+{
+    struct globalfifo_mmsg mm;
+    long n = want < s->batch ? want : s->batch;
+    long i = 0;
+    ssize_t ret = 0;
+
+    s->calls++;
+
+    if (s->batch == 0) {
+        if (do_send)
+            ret = write(s->fd, s->bufs[0], MSG_LEN);
+        else
+            ret = read(s->fd, s->bufs[0], MSG_LEN);
+        return ret == MSG_LEN ? 1 : -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        s->msgs[i].buf = (uintptr_t)s->bufs[i];
+        s->msgs[i].len = MSG_LEN;
+    }
+
+    memset(&mm, 0, sizeof(mm));
+    mm.msgs = (uintptr_t)s->msgs;
+    mm.vlen = n;
+    return ioctl(s->fd, do_send ? GLOBALFIFO_IOC_SEND_MMSG :
+        GLOBALFIFO_IOC_RECV_MMSG, &mm);
+}
+
+static void *producer(void *arg)
+{
+    struct side *s = arg;
+    long left = s->records;
+    long ret = 0;
+
+    memset(s->bufs, 'm', sizeof(s->bufs));
+
+    while (left > 0) {
+        ret = xfer(s, left, 1);
+        if (ret <= 0) {
+            printf("send failed\n");
+            break;
+        }
+        left -= ret;
+    }
+
+    return NULL;
+}
+
+static double run(int rfd, int wfd, int batch, long records,
+    double *calls)
+{
+    static struct side prod;
+    static struct side cons;
+    pthread_t tp;
+    long left = records;
+    long ret = 0;
+    double start = 0;
+
+    prod.fd = wfd;
+    cons.fd = rfd;
+    prod.batch = cons.batch = batch;
+    prod.records = cons.records = records;
+    prod.calls = cons.calls = 0;
+
+    start = now_ns();
+    pthread_create(&tp, NULL, producer, &prod);
+    while (left > 0) {
+        ret = xfer(&cons, left, 0);
+        if (ret <= 0) {
+            printf("receive failed\n");
+            break;
+        }
+        left -= ret;
+    }
+    pthread_join(tp, NULL);
+
+    *calls = (double)(prod.calls + cons.calls) / records;
+    return (now_ns() - start) / records;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int batches[] = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    long records = argc > 1 ? atol(argv[1]) : 1000000;
+    double calls = 0;
+    double ns = 0;
+    unsigned int i = 0;
+    int rfd = -1;
+    int wfd = -1;
+
+    /* the mode can only be changed while we are the sole opener */
+    rfd = open(DEV_NAME, O_RDONLY);
+    if (rfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(rfd, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(rfd, GLOBALFIFO_IOC_SET_MODE, GLOBALFIFO_MODE_RECORD)) {
+        printf("set record mode failed, is %s in use?\n", DEV_NAME);
+        close(rfd);
+        return -1;
+    }
+    if (ioctl(rfd, GLOBALFIFO_IOC_RESIZE, FIFO_LEN))
+        printf("resize to %d failed\n", FIFO_LEN);
+
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        close(rfd);
+        return -1;
+    }
+
+    printf("%8s %12s %12s %12s\n", "batch", "ns/msg", "msgs/s", "calls/msg");
+    for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+        ns = run(rfd, wfd, batches[i], records, &calls);
+        if (batches[i] == 0)
+            printf("%8s", "read");
+        else
+            printf("%8d", batches[i]);
+        printf(" %12.1f %12.0f %12.3f\n", ns, 1e9 / ns, calls);
+    }
+
+    close(wfd);
+    ioctl(rfd, GLOBALFIFO_IOC_SET_MODE, 0);
+    close(rfd);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Small-operation rate: alternate SMALL_LEN byte pwrite()/pread() calls
+ * on a device for a fixed time and report operations per second.
+ *
+ * Compare a driver that printk()s every operation with one using
+ * tracepoints, and the tracepoint build with the events disabled and
+ * enabled (echo 1 > /sys/kernel/tracing/events/globalfifo/enable).
+ *
+ * usage: bench_ops [device] [seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define SMALL_LEN   16
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int i = 0;
+    long ops = 0;
+    double seconds = argc > 2 ? atof(argv[2]) : 5;
+    const char *name = argc > 1 ? argv[1] : DEV_NAME;
+    double start = 0;
+    double spent = 0;
+    char wbuf[SMALL_LEN];
+    char rbuf[SMALL_LEN];
+
+    fd = open(name, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        printf("open %s failed\n", name);
+        return -1;
+    }
+
+    memset(wbuf, 'o', sizeof(wbuf));
+    start = now_sec();
+
+    do {
+        /* check the clock every 1024 operation pairs */
+        for (i = 0; i < 1024; i++) {
+            if (pwrite(fd, wbuf, SMALL_LEN, 0) != SMALL_LEN ||
+                pread(fd, rbuf, SMALL_LEN, 0) != SMALL_LEN) {
+                printf("%s: I/O failed after %ld ops\n", name, ops);
+                close(fd);
+                return -1;
+            }
+        }
+        ops += 2 * 1024;
+        spent = now_sec() - start;
+    } while (spent < seconds);
+
+    printf("%s: %ld ops in %.2f s, %.0f ops/s\n", name, ops, spent,
+        ops / spent);
+
+    close(fd);
+    return 0;
+}
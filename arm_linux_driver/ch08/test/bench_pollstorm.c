@@ -0,0 +1,204 @@
+/*
+ * Writer throughput on /dev/globalfifo0 while other threads hammer
+ * epoll_wait() on it.
+ *
+ * A writer and a reader thread stream data through the device for the
+ * given number of seconds, with 0, 1, 2, 4, ... up to max_pollers extra
+ * threads each looping on epoll_wait() over their own fd. The pollers
+ * ask for EPOLLIN | EPOLLOUT level-triggered, so the device is nearly
+ * always ready and every epoll_wait() call goes down to the driver's
+ * poll(), which is how a busy event loop looks to it. The writer's
+ * MiB/s and the total poll() calls per second are reported.
+ *
+ * poll() used to take the device mutex, which the writer and reader
+ * need too, so the writer's rate fell as pollers were added; run this
+ * against the module before and after the lockless poll() to compare.
+ *
+ * usage: bench_pollstorm [seconds] [max_pollers] [write_size]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define MAX_POLLERS 64
+
+static volatile int writing;
+static volatile int reading;
+static volatile int polling;
+static size_t wsize = 256;
+
+struct poller {
+    pthread_t tid;
+    long polls;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer(void *arg)
+{
+    long *bytes = arg;
+    char *buf = NULL;
+    ssize_t n = 0;
+    int fd = -1;
+
+    buf = calloc(1, wsize);
+    fd = open(DEV_NAME, O_WRONLY);
+    if (!buf || fd < 0) {
+        printf("writer: open %s failed\n", DEV_NAME);
+        free(buf);
+        return NULL;
+    }
+
+    while (writing) {
+        n = write(fd, buf, wsize);
+        if (n < 0 && errno != EINTR) {
+            printf("writer: %s\n", strerror(errno));
+            break;
+        }
+        if (n > 0)
+            *bytes += n;
+    }
+
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+/* drains until told to stop, so the writer never stays blocked */
+static void *reader(void *arg)
+{
+    char buf[4096];
+    struct pollfd pfd;
+    int fd = -1;
+
+    fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        printf("reader: open %s failed\n", DEV_NAME);
+        return NULL;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (reading) {
+        if (read(fd, buf, sizeof(buf)) < 0 && errno == EAGAIN)
+            poll(&pfd, 1, 10);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void *poller(void *arg)
+{
+    struct poller *p = arg;
+    struct epoll_event ev;
+    int epfd = -1;
+    int fd = -1;
+
+    fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+    epfd = epoll_create1(0);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT;
+    if (fd < 0 || epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        printf("poller: epoll setup failed\n");
+        return NULL;
+    }
+
+    while (polling) {
+        if (epoll_wait(epfd, &ev, 1, 10) >= 0)
+            p->polls++;
+    }
+
+    close(epfd);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct poller pollers[MAX_POLLERS];
+    pthread_t wtid;
+    pthread_t rtid;
+    double secs = argc > 1 ? atof(argv[1]) : 2;
+    int max = argc > 2 ? atoi(argv[2]) : 8;
+    double base = 0;
+    double rate = 0;
+    double t = 0;
+    long bytes = 0;
+    long polls = 0;
+    int nr = 0;
+    int fd = -1;
+    int i = 0;
+
+    if (argc > 3)
+        wsize = atol(argv[3]);
+    if (secs <= 0 || max < 0 || max > MAX_POLLERS || wsize == 0) {
+        printf("usage: %s [seconds] [max_pollers] [write_size]\n", argv[0]);
+        return -1;
+    }
+
+    fd = open(DEV_NAME, O_RDONLY);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(fd, GLOBALFIFO_IOC_CLEAR);
+
+    printf("%zu byte writes, %.1f s per run\n", wsize, secs);
+    printf("%8s %12s %10s %14s\n", "pollers", "write MiB/s", "relative",
+        "polls/s");
+
+    for (nr = 0; nr <= max; nr = nr ? nr * 2 : 1) {
+        polling = 1;
+        for (i = 0; i < nr; i++) {
+            pollers[i].polls = 0;
+            pthread_create(&pollers[i].tid, NULL, poller, &pollers[i]);
+        }
+
+        bytes = 0;
+        writing = reading = 1;
+        pthread_create(&rtid, NULL, reader, NULL);
+        t = now_sec();
+        pthread_create(&wtid, NULL, writer, &bytes);
+        usleep(secs * 1e6);
+        writing = 0;
+        pthread_join(wtid, NULL);
+        t = now_sec() - t;
+        reading = 0;
+        pthread_join(rtid, NULL);
+
+        polling = 0;
+        polls = 0;
+        for (i = 0; i < nr; i++) {
+            pthread_join(pollers[i].tid, NULL);
+            polls += pollers[i].polls;
+        }
+        ioctl(fd, GLOBALFIFO_IOC_CLEAR);
+
+        rate = bytes / t / (1 << 20);
+        if (nr == 0)
+            base = rate;
+        printf("%8d %12.1f %10.2f %14.0f\n", nr, rate,
+            base ? rate / base : 0, polls / t);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Small-read throughput against a full FIFO.
+ *
+ * Fills /dev/globalfifo0 to GLOBALFIFO_SIZE and drains it with BUF_LEN
+ * byte reads, timing only the reads. Run it once against the old driver
+ * and once against the ring-buffer driver to compare.
+ *
+ * usage: bench_read [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define FIFO_LEN    4096
+#define BUF_LEN     16
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int i = 0;
+    int rounds = 1000;
+    long reads = 0;
+    long bytes = 0;
+    ssize_t count = 0;
+    double start = 0;
+    double spent = 0;
+    char fill[FIFO_LEN];
+    char buf[BUF_LEN];
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    fd = open("/dev/globalfifo0", O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        printf("open /dev/globalfifo0 failed\n");
+        return -1;
+    }
+
+    ioctl(fd, GLOBALFIFO_IOC_CLEAR);
+    memset(fill, 'a', sizeof(fill));
+
+    for (i = 0; i < rounds; i++) {
+        if (write(fd, fill, sizeof(fill)) != sizeof(fill)) {
+            printf("fill globalfifo0 failed, is it empty?\n");
+            close(fd);
+            return -1;
+        }
+
+        start = now_sec();
+        while ((count = read(fd, buf, BUF_LEN)) > 0) {
+            reads++;
+            bytes += count;
+        }
+        spent += now_sec() - start;
+    }
+
+    printf("%ld reads of %d bytes in %.3f s\n", reads, BUF_LEN, spent);
+    printf("%.0f reads/s, %.2f MiB/s, %.0f ns/read\n",
+        reads / spent, bytes / spent / (1024 * 1024), spent * 1e9 / reads);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Wakeup-to-data latency and consumer CPU time with many globalfifo
+ * devices, per-fd epoll against one eventfd plus GLOBALFIFO_IOC_GET_READY.
+ *
+ * For 8, 16, ... up to the number of devices, a producer thread writes
+ * an 8-byte CLOCK_MONOTONIC stamp to a randomly chosen device every
+ * interval, in bursts of burst writes. The consumer drains them either
+ *
+ *   epoll    with every device in one epoll set, reading each fd epoll
+ *            reports until EAGAIN, as test_epoll.c does
+ *   eventfd  with one eventfd attached to every device, reading it, then
+ *            GET_READY, then reading each device reported until EAGAIN
+ *
+ * and the latency from write to read and the consumer thread's CPU time
+ * per message are reported.
+ *
+ * Load the module with globalfifo_nr_devs=256 to go up to 256 devices.
+ *
+ * usage: bench_ready [messages] [burst] [interval_us]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define NR_DEVS_PARAM   "/sys/module/globalfifo/parameters/globalfifo_nr_devs"
+#define MAX_DEVS        256
+
+enum { MODE_EPOLL, MODE_EVENTFD, NR_MODES };
+
+static const char *mode_names[NR_MODES] = { "epoll", "eventfd" };
+
+static int fds[MAX_DEVS];
+static int nr_fds;
+static long nr_msgs = 100000;
+static long burst = 1;
+static long interval_ns = 20000;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int nr_devices(void)
+{
+    FILE *fp = NULL;
+    int nr = GLOBALFIFO_DEV_NUM;
+
+    fp = fopen(NR_DEVS_PARAM, "r");
+    if (!fp)
+        return nr;
+    if (fscanf(fp, "%d", &nr) != 1)
+        nr = GLOBALFIFO_DEV_NUM;
+    fclose(fp);
+
+    return nr > MAX_DEVS ? MAX_DEVS : nr;
+}
+
+static void *producer(void *arg)
+{
+    struct timespec gap = { 0, interval_ns };
+    unsigned int seed = 1;
+    uint64_t stamp = 0;
+    long i = 0;
+
+    for (i = 0; i < nr_msgs; i++) {
+        stamp = now_ns();
+        if (write(fds[rand_r(&seed) % nr_fds], &stamp, sizeof(stamp)) !=
+            sizeof(stamp))
+            printf("write failed\n");
+        if (interval_ns && (i + 1) % burst == 0)
+            nanosleep(&gap, NULL);
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* read fd until EAGAIN, recording the latency of every stamp */
+static long drain(int fd, uint64_t *lat, long n)
+{
+    uint64_t buf[64];
+    uint64_t t = 0;
+    ssize_t ret = 0;
+    ssize_t i = 0;
+
+    while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+        t = now_ns();
+        for (i = 0; i < ret / (ssize_t)sizeof(uint64_t) && n < nr_msgs; i++)
+            lat[n++] = t - buf[i];
+    }
+
+    return n;
+}
+
+static long consume_epoll(uint64_t *lat)
+{
+    struct epoll_event ev[MAX_DEVS];
+    long n = 0;
+    int epfd = -1;
+    int ret = 0;
+    int i = 0;
+
+    epfd = epoll_create1(0);
+    for (i = 0; i < nr_fds; i++) {
+        memset(&ev[0], 0, sizeof(ev[0]));
+        ev[0].events = EPOLLIN;
+        ev[0].data.fd = fds[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev[0])) {
+            printf("epoll add failed\n");
+            close(epfd);
+            return 0;
+        }
+    }
+
+    while (n < nr_msgs) {
+        ret = epoll_wait(epfd, ev, nr_fds, 1000);
+        if (ret <= 0) {
+            printf("epoll: %ld of %ld messages, then nothing\n", n, nr_msgs);
+            break;
+        }
+        for (i = 0; i < ret; i++)
+            n = drain(ev[i].data.fd, lat, n);
+    }
+
+    close(epfd);
+    return n;
+}
+
+static long consume_eventfd(uint64_t *lat)
+{
+    uint64_t mask[MAX_DEVS / 64];
+    struct globalfifo_ready rq;
+    uint64_t count = 0;
+    long n = 0;
+    int efd = -1;
+    int i = 0;
+
+    efd = eventfd(0, 0);
+    for (i = 0; i < nr_fds; i++) {
+        if (ioctl(fds[i], GLOBALFIFO_IOC_SET_EVENTFD, efd)) {
+            printf("SET_EVENTFD failed: %s\n", strerror(errno));
+            close(efd);
+            return 0;
+        }
+    }
+
+    memset(&rq, 0, sizeof(rq));
+    rq.mask = (uintptr_t)mask;
+    rq.nbits = nr_fds;
+
+    while (n < nr_msgs) {
+        if (read(efd, &count, sizeof(count)) != sizeof(count))
+            break;
+
+        /* devices filled while draining show up in the next round */
+        while (n < nr_msgs &&
+            ioctl(fds[0], GLOBALFIFO_IOC_GET_READY, &rq) > 0) {
+            for (i = 0; i < nr_fds; i++) {
+                if (mask[i / 64] & (1ULL << (i % 64)))
+                    n = drain(fds[i], lat, n);
+            }
+        }
+    }
+
+    for (i = 0; i < nr_fds; i++)
+        ioctl(fds[i], GLOBALFIFO_IOC_SET_EVENTFD, -1);
+    close(efd);
+    return n;
+}
+
+static double cpu_sec(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    char fname[32];
+    pthread_t tid;
+    uint64_t *lat = NULL;
+    int max = nr_devices();
+    double cpu = 0;
+    long n = 0;
+    int mode = 0;
+    int i = 0;
+
+    if (argc > 1)
+        nr_msgs = atol(argv[1]);
+    if (argc > 2)
+        burst = atol(argv[2]);
+    if (argc > 3)
+        interval_ns = atol(argv[3]) * 1000;
+    if (nr_msgs < 1 || burst < 1 || interval_ns < 0 ||
+        interval_ns >= 1000000000) {
+        printf("usage: %s [messages] [burst] [interval_us]\n", argv[0]);
+        return -1;
+    }
+
+    for (i = 0; i < max; i++) {
+        sprintf(fname, "/dev/globalfifo%d", i);
+        fds[i] = open(fname, O_RDWR | O_NONBLOCK);
+        if (fds[i] < 0) {
+            printf("open %s failed\n", fname);
+            return -1;
+        }
+        ioctl(fds[i], GLOBALFIFO_IOC_CLEAR);
+    }
+
+    lat = calloc(nr_msgs, sizeof(*lat));
+    if (!lat)
+        return -1;
+
+    printf("%ld messages in bursts of %ld every %ld us\n", nr_msgs, burst,
+        interval_ns / 1000);
+    printf("%8s %8s %10s %10s %10s %12s\n", "devices", "consumer", "p50 us",
+        "p99 us", "max us", "cpu us/msg");
+
+    for (nr_fds = 8; ; nr_fds = nr_fds * 2 > max ? max : nr_fds * 2) {
+        if (nr_fds > max)
+            nr_fds = max;
+
+        for (mode = 0; mode < NR_MODES; mode++) {
+            cpu = cpu_sec();
+            pthread_create(&tid, NULL, producer, NULL);
+            if (mode == MODE_EPOLL)
+                n = consume_epoll(lat);
+            else
+                n = consume_eventfd(lat);
+            pthread_join(tid, NULL);
+            cpu = cpu_sec() - cpu;
+
+            for (i = 0; i < nr_fds; i++)
+                ioctl(fds[i], GLOBALFIFO_IOC_CLEAR);
+            if (n == 0)
+                continue;
+
+            qsort(lat, n, sizeof(*lat), cmp_u64);
+            printf("%8d %8s %10.1f %10.1f %10.1f %12.2f\n", nr_fds,
+                mode_names[mode], lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3,
+                lat[n - 1] / 1e3, cpu * 1e6 / n);
+        }
+
+        if (nr_fds >= max)
+            break;
+    }
+
+    for (i = 0; i < max; i++)
+        close(fds[i]);
+    free(lat);
+    return 0;
+}
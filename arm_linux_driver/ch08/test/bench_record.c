@@ -0,0 +1,200 @@
+/*
+ * Messages per second for REC_LEN byte records through /dev/globalfifo0.
+ *
+ * record:   GLOBALFIFO_MODE_RECORD, one write() and one read() per record
+ * stream:   byte stream, the producer prepends a length header and the
+ *           consumer reads BUF_LEN bytes at a time and reassembles, as
+ *           the test_poll.c style loops do
+ * bulk:     byte stream with the same framing, but the consumer reads
+ *           as much as it can and splits records out of its own buffer
+ *
+ * The consumer checks that every record carries the expected sequence
+ * number, and the number of read() calls per record is reported.
+ *
+ * usage: bench_record <record|stream|bulk> [records]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define REC_LEN     64
+#define BUF_LEN     16
+#define BULK_LEN    65536
+
+struct bench {
+    int rfd;
+    int wfd;
+    int framed;
+    long records;
+    long reads;
+    long bad;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t ret = 0;
+
+    for (done = 0; done < len; done += ret) {
+        ret = write(fd, buf + done, len - done);
+        if (ret <= 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void *producer(void *arg)
+{
+    struct bench *b = arg;
+    char msg[sizeof(uint32_t) + REC_LEN];
+    uint32_t hdr = REC_LEN;
+    char *rec = b->framed ? msg + sizeof(hdr) : msg;
+    size_t len = b->framed ? sizeof(msg) : REC_LEN;
+    long i = 0;
+
+    memcpy(msg, &hdr, sizeof(hdr));
+    memset(rec, 'r', REC_LEN);
+
+    for (i = 0; i < b->records; i++) {
+        memcpy(rec, &i, sizeof(i));
+        if (write_all(b->wfd, msg, len)) {
+            printf("producer write failed\n");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void check(struct bench *b, const char *rec, long seq)
+{
+    long got = 0;
+
+    memcpy(&got, rec, sizeof(got));
+    if (got != seq)
+        b->bad++;
+}
+
+static void consume_record(struct bench *b)
+{
+    char rec[REC_LEN];
+    long i = 0;
+
+    for (i = 0; i < b->records; i++) {
+        if (read(b->rfd, rec, sizeof(rec)) != REC_LEN) {
+            printf("short record\n");
+            return;
+        }
+        b->reads++;
+        check(b, rec, i);
+    }
+}
+
+/* stream and bulk: reassemble length-prefixed records from read_len reads */
+static void consume_stream(struct bench *b, size_t read_len)
+{
+    static char buf[BULK_LEN + sizeof(uint32_t) + REC_LEN];
+    size_t have = 0;
+    size_t off = 0;
+    uint32_t hdr = 0;
+    ssize_t ret = 0;
+    long i = 0;
+
+    while (i < b->records) {
+        ret = read(b->rfd, buf + have, read_len);
+        if (ret <= 0) {
+            printf("consumer read failed\n");
+            return;
+        }
+        b->reads++;
+        have += ret;
+
+        for (off = 0; have - off >= sizeof(hdr); off += sizeof(hdr) + hdr) {
+            memcpy(&hdr, buf + off, sizeof(hdr));
+            if (have - off < sizeof(hdr) + hdr)
+                break;
+            check(b, buf + off + sizeof(hdr), i++);
+        }
+
+        memmove(buf, buf + off, have - off);
+        have -= off;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench b;
+    pthread_t tp;
+    unsigned long mode = 0;
+    double start = 0;
+    double spent = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <record|stream|bulk> [records]\n", argv[0]);
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.records = argc > 2 ? atol(argv[2]) : 1000000;
+    b.framed = strcmp(argv[1], "record") != 0;
+    if (!b.framed)
+        mode = GLOBALFIFO_MODE_RECORD;
+
+    /* the mode can only be changed while we are the sole opener */
+    b.rfd = open(DEV_NAME, O_RDONLY);
+    if (b.rfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(b.rfd, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(b.rfd, GLOBALFIFO_IOC_SET_MODE, mode)) {
+        printf("set mode failed, is %s in use?\n", DEV_NAME);
+        close(b.rfd);
+        return -1;
+    }
+
+    b.wfd = open(DEV_NAME, O_WRONLY);
+    if (b.wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        close(b.rfd);
+        return -1;
+    }
+
+    start = now_sec();
+    pthread_create(&tp, NULL, producer, &b);
+    if (!b.framed)
+        consume_record(&b);
+    else if (strcmp(argv[1], "bulk") == 0)
+        consume_stream(&b, BULK_LEN);
+    else
+        consume_stream(&b, BUF_LEN);
+    pthread_join(tp, NULL);
+    spent = now_sec() - start;
+
+    printf("%s: %ld records of %d bytes in %.3f s\n", argv[1], b.records,
+        REC_LEN, spent);
+    printf("%.0f msgs/s, %.2f reads/msg, %ld out of sequence\n",
+        b.records / spent, (double)b.reads / b.records, b.bad);
+
+    close(b.wfd);
+    ioctl(b.rfd, GLOBALFIFO_IOC_SET_MODE, 0);
+    close(b.rfd);
+    return b.bad ? -1 : 0;
+}
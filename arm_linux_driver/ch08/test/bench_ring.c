@@ -0,0 +1,200 @@
+/*
+ * Drain a sustained stream from /dev/globalfifo0 either with read() of
+ * BUF_LEN bytes (the test_epoll.c pattern) or in place through the mmap
+ * ring, and report throughput and consumer syscalls per MiB.
+ *
+ * A child process produces a byte counter pattern which the consumer
+ * verifies.
+ *
+ * build: gcc -O2 -o bench_ring bench_ring.c globalfifo_ring.c
+ * usage: bench_ring <read|ring> [MiB] [read_len]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "globalfifo_ring.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define BUF_LEN     16
+#define WRITE_LEN   4096
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void produce(size_t total)
+{
+    int fd = -1;
+    size_t done = 0;
+    size_t i = 0;
+    size_t n = 0;
+    ssize_t ret = 0;
+    unsigned char buf[WRITE_LEN];
+
+    fd = open(DEV_NAME, O_WRONLY);
+    if (fd < 0)
+        exit(1);
+
+    while (done < total) {
+        n = total - done < WRITE_LEN ? total - done : WRITE_LEN;
+        for (i = 0; i < n; i++)
+            buf[i] = (unsigned char)(done + i);
+
+        /* a short write just restarts the pattern at the new offset */
+        ret = write(fd, buf, n);
+        if (ret <= 0)
+            exit(1);
+        done += ret;
+    }
+
+    close(fd);
+    exit(0);
+}
+
+static int check(const unsigned char *buf, size_t len, size_t *seen)
+{
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] != (unsigned char)(*seen + i)) {
+            printf("data mismatch at byte %zu\n", *seen + i);
+            return -1;
+        }
+    }
+    *seen += len;
+    return 0;
+}
+
+static int consume_read(size_t total, size_t read_len, unsigned long *syscalls)
+{
+    int fd = -1;
+    size_t seen = 0;
+    ssize_t count = 0;
+    unsigned char *buf = malloc(read_len);
+    struct pollfd pfd;
+
+    fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+    if (fd < 0 || !buf) {
+        printf("open %s failed\n", DEV_NAME);
+        free(buf);
+        return -1;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLRDNORM;
+
+    while (seen < total) {
+        count = read(fd, buf, read_len);
+        (*syscalls)++;
+        if (count > 0) {
+            if (check(buf, count, &seen))
+                break;
+        } else if (count < 0 && errno == EAGAIN) {
+            poll(&pfd, 1, 1000);
+            (*syscalls)++;
+        } else {
+            printf("read %s failed\n", DEV_NAME);
+            break;
+        }
+    }
+
+    close(fd);
+    free(buf);
+    return seen == total ? 0 : -1;
+}
+
+static int consume_ring(size_t total, unsigned long *syscalls)
+{
+    struct globalfifo_ring ring;
+    const void *p = NULL;
+    size_t chunk = 0;
+    size_t seen = 0;
+
+    if (globalfifo_ring_open(&ring, DEV_NAME)) {
+        printf("map %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    while (seen < total) {
+        if (globalfifo_ring_peek(&ring, &p, &chunk) == 0) {
+            globalfifo_ring_wait(&ring, 1000);
+            continue;
+        }
+
+        if (check(p, chunk, &seen))
+            break;
+        globalfifo_ring_consume(&ring, chunk);
+    }
+
+    *syscalls = ring.syscalls;
+    globalfifo_ring_close(&ring);
+    return seen == total ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = -1;
+    int ret = 0;
+    int status = 0;
+    pid_t pid = 0;
+    size_t mib = 256;
+    size_t read_len = BUF_LEN;
+    size_t total = 0;
+    unsigned long syscalls = 0;
+    double start = 0;
+    double spent = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <read|ring> [MiB] [read_len]\n", argv[0]);
+        return -1;
+    }
+    if (argc > 2)
+        mib = strtoul(argv[2], NULL, 0);
+    if (argc > 3)
+        read_len = strtoul(argv[3], NULL, 0);
+    total = mib << 20;
+
+    fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(fd, GLOBALFIFO_IOC_CLEAR);
+    close(fd);
+
+    pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        return -1;
+    }
+    if (pid == 0)
+        produce(total);
+
+    start = now_sec();
+    if (strcmp(argv[1], "ring") == 0)
+        ret = consume_ring(total, &syscalls);
+    else
+        ret = consume_read(total, read_len, &syscalls);
+    spent = now_sec() - start;
+
+    if (ret)
+        kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+
+    printf("%s: %zu MiB in %.3f s, %.1f MiB/s, %.1f syscalls/MiB\n",
+        argv[1], mib, spent, mib / spent, (double)syscalls / mib);
+
+    return ret;
+}
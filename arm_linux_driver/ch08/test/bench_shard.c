@@ -0,0 +1,197 @@
+/*
+ * Fan-in scaling: 1 to max_threads writer threads each push REC_LEN
+ * byte records into /dev/globalfifo0 while one reader drains it.
+ *
+ * mutex:    the default single ring under the device mutex
+ * sharded:  GLOBALFIFO_MODE_SHARDED per-CPU sub-rings
+ * ordered:  sharded plus GLOBALFIFO_MODE_ORDERED sequence stamps
+ *
+ * Aggregate throughput is reported together with the voluntary context
+ * switches per 1000 writes, which is where writers sleeping on a
+ * contended mutex show up, and the number of records that arrived out
+ * of their writer's order.
+ *
+ * usage: bench_shard <mutex|sharded|ordered> [max_threads] [records]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define FIFO_LEN    65536
+#define REC_LEN     64
+#define READ_LEN    (REC_LEN * 1024)
+#define MAX_THREADS 256
+
+struct rec {
+    uint32_t writer;
+    uint32_t pad;
+    uint64_t seq;
+    char fill[REC_LEN - 16];
+};
+
+struct writer {
+    int fd;
+    uint32_t id;
+    long records;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *write_thread(void *arg)
+{
+    struct writer *w = arg;
+    struct rec r;
+    long i = 0;
+
+    memset(&r, 'f', sizeof(r));
+    r.writer = w->id;
+
+    /* FIFO and reads are multiples of REC_LEN, so writes never split */
+    for (i = 0; i < w->records; i++) {
+        r.seq = i;
+        if (write(w->fd, &r, sizeof(r)) != sizeof(r)) {
+            printf("writer %u failed\n", w->id);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* drain nr * records records, returns how many came out of order */
+static long drain(int fd, int nr, long records)
+{
+    static char buf[READ_LEN];
+    static uint64_t next[MAX_THREADS];
+    long left = nr * records;
+    long reordered = 0;
+    struct rec *r = NULL;
+    ssize_t ret = 0;
+    ssize_t off = 0;
+
+    memset(next, 0, sizeof(next));
+
+    while (left > 0) {
+        ret = read(fd, buf, sizeof(buf));
+        if (ret <= 0 || ret % REC_LEN) {
+            printf("bad read %zd\n", ret);
+            break;
+        }
+
+        for (off = 0; off < ret; off += REC_LEN) {
+            r = (struct rec *)(buf + off);
+            if (r->writer < MAX_THREADS) {
+                if (r->seq != next[r->writer])
+                    reordered++;
+                next[r->writer] = r->seq + 1;
+            }
+            left--;
+        }
+    }
+
+    return reordered;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct writer writers[MAX_THREADS];
+    static pthread_t tids[MAX_THREADS];
+    struct rusage before;
+    struct rusage after;
+    unsigned long mode = 0;
+    int max = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    long records = argc > 3 ? atol(argv[3]) : 200000;
+    long reordered = 0;
+    long vcsw = 0;
+    double start = 0;
+    double spent = 0;
+    int rfd = -1;
+    int wfd = -1;
+    int nr = 0;
+    int i = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <mutex|sharded|ordered> [max_threads] [records]\n",
+            argv[0]);
+        return -1;
+    }
+
+    if (strcmp(argv[1], "sharded") == 0)
+        mode = GLOBALFIFO_MODE_SHARDED;
+    else if (strcmp(argv[1], "ordered") == 0)
+        mode = GLOBALFIFO_MODE_SHARDED | GLOBALFIFO_MODE_ORDERED;
+    if (max > MAX_THREADS)
+        max = MAX_THREADS;
+
+    /* the mode can only be changed while we are the sole opener */
+    rfd = open(DEV_NAME, O_RDONLY);
+    if (rfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(rfd, GLOBALFIFO_IOC_CLEAR);
+    ioctl(rfd, GLOBALFIFO_IOC_SET_MODE, 0);
+    if (ioctl(rfd, GLOBALFIFO_IOC_RESIZE, FIFO_LEN))
+        printf("resize to %d failed\n", FIFO_LEN);
+    if (ioctl(rfd, GLOBALFIFO_IOC_SET_MODE, mode)) {
+        printf("set mode %s failed, is %s in use?\n", argv[1], DEV_NAME);
+        close(rfd);
+        return -1;
+    }
+
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        close(rfd);
+        return -1;
+    }
+
+    printf("%8s %10s %12s %14s %10s\n", "threads", "MiB/s", "msgs/s",
+        "vcsw/1k wr", "reordered");
+
+    for (nr = 1; ; nr = nr * 2 > max ? max : nr * 2) {
+        getrusage(RUSAGE_SELF, &before);
+        start = now_sec();
+
+        for (i = 0; i < nr; i++) {
+            writers[i].fd = wfd;
+            writers[i].id = i;
+            writers[i].records = records;
+            pthread_create(&tids[i], NULL, write_thread, &writers[i]);
+        }
+        reordered = drain(rfd, nr, records);
+        for (i = 0; i < nr; i++)
+            pthread_join(tids[i], NULL);
+
+        spent = now_sec() - start;
+        getrusage(RUSAGE_SELF, &after);
+        vcsw = after.ru_nvcsw - before.ru_nvcsw;
+
+        printf("%8d %10.1f %12.0f %14.2f %10ld\n", nr,
+            nr * records * REC_LEN / spent / (1024 * 1024),
+            nr * records / spent, vcsw * 1000.0 / (nr * records), reordered);
+
+        if (nr >= max)
+            break;
+    }
+
+    close(wfd);
+    ioctl(rfd, GLOBALFIFO_IOC_SET_MODE, 0);
+    close(rfd);
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Producer/consumer throughput through /dev/globalfifo0 in its default
+ * mode, for CHUNK sized writes and reads from 4 KiB up to 64 KiB. With
+ * readers and writers on separate locks the two sides copy at the same
+ * time, so large chunks should come close to the SPSC numbers.
+ *
+ * With one thread per side the consumer also checks every byte against
+ * the producer's pattern; with more, only the byte counts are checked.
+ *
+ * usage: bench_split [MiB] [threads_per_side]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define FIFO_LEN    (256 * 1024)
+#define MAX_CHUNK   (64 * 1024)
+#define MAX_THREADS 16
+
+struct side {
+    int fd;
+    size_t chunk;
+    size_t bytes;
+    int check;
+    long bad;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char pattern(size_t off)
+{
+    return off % 251;
+}
+
+static void *producer(void *arg)
+{
+    struct side *s = arg;
+    unsigned char *buf = malloc(MAX_CHUNK);
+    size_t done = 0;
+    size_t n = 0;
+    size_t i = 0;
+    ssize_t ret = 0;
+
+    while (buf && done < s->bytes) {
+        n = s->bytes - done < s->chunk ? s->bytes - done : s->chunk;
+        for (i = 0; s->check && i < n; i++)
+            buf[i] = pattern(done + i);
+
+        /* a stream write may be cut short by the free space */
+        for (i = 0; i < n; i += ret) {
+            ret = write(s->fd, buf + i, n - i);
+            if (ret <= 0) {
+                printf("write failed\n");
+                free(buf);
+                return NULL;
+            }
+        }
+        done += n;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct side *s = arg;
+    unsigned char *buf = malloc(MAX_CHUNK);
+    size_t done = 0;
+    size_t n = 0;
+    ssize_t ret = 0;
+    ssize_t i = 0;
+
+    while (buf && done < s->bytes) {
+        n = s->bytes - done < s->chunk ? s->bytes - done : s->chunk;
+        ret = read(s->fd, buf, n);
+        if (ret <= 0) {
+            printf("read failed\n");
+            break;
+        }
+
+        for (i = 0; s->check && i < ret; i++) {
+            if (buf[i] != pattern(done + i))
+                s->bad++;
+        }
+        done += ret;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t chunks[] = { 4096, 16384, 65536 };
+    static struct side prod[MAX_THREADS];
+    static struct side cons[MAX_THREADS];
+    pthread_t tp[MAX_THREADS];
+    pthread_t tc[MAX_THREADS];
+    size_t mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 1024;
+    int nr = argc > 2 ? atoi(argv[2]) : 1;
+    size_t share = 0;
+    double start = 0;
+    double spent = 0;
+    long bad = 0;
+    unsigned int c = 0;
+    int rfd = -1;
+    int wfd = -1;
+    int i = 0;
+
+    if (nr < 1 || nr > MAX_THREADS) {
+        printf("threads_per_side must be 1 to %d\n", MAX_THREADS);
+        return -1;
+    }
+    share = (mib << 20) / nr;
+
+    rfd = open(DEV_NAME, O_RDONLY);
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (rfd < 0 || wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(rfd, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(rfd, GLOBALFIFO_IOC_RESIZE, FIFO_LEN))
+        printf("resize to %d failed\n", FIFO_LEN);
+
+    printf("%d producer(s), %d consumer(s), %zu MiB per run\n", nr, nr,
+        share * nr >> 20);
+    printf("%8s %10s %10s\n", "chunk", "MiB/s", "bad bytes");
+
+    for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        start = now_sec();
+        for (i = 0; i < nr; i++) {
+            prod[i].fd = wfd;
+            cons[i].fd = rfd;
+            prod[i].chunk = cons[i].chunk = chunks[c];
+            prod[i].bytes = cons[i].bytes = share;
+            prod[i].check = cons[i].check = nr == 1;
+            cons[i].bad = 0;
+            pthread_create(&tp[i], NULL, producer, &prod[i]);
+            pthread_create(&tc[i], NULL, consumer, &cons[i]);
+        }
+
+        bad = 0;
+        for (i = 0; i < nr; i++) {
+            pthread_join(tp[i], NULL);
+            pthread_join(tc[i], NULL);
+            bad += cons[i].bad;
+        }
+        spent = now_sec() - start;
+
+        printf("%7zuK %10.1f %10ld\n", chunks[c] >> 10,
+            (share * nr >> 20) / spent, bad);
+    }
+
+    close(wfd);
+    close(rfd);
+    return 0;
+}
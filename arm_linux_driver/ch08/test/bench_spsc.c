@@ -0,0 +1,179 @@
+/*
+ * One producer and one consumer thread pinned to different cores,
+ * passing MSG_LEN byte messages through /dev/globalfifo0. Each message
+ * carries its send time, so the consumer reports both throughput and
+ * end-to-end latency.
+ *
+ * usage: bench_spsc <mutex|spsc> [messages] [producer_cpu] [consumer_cpu]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define MSG_LEN     64
+
+struct worker {
+    int fd;
+    int cpu;
+    long messages;
+    double max_lat;
+    double sum_lat;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        printf("pin to cpu %d failed, running unpinned\n", cpu);
+}
+
+static int xfer(int fd, char *buf, size_t len, int do_write)
+{
+    size_t done = 0;
+    ssize_t ret = 0;
+
+    while (done < len) {
+        if (do_write)
+            ret = write(fd, buf + done, len - done);
+        else
+            ret = read(fd, buf + done, len - done);
+        if (ret <= 0)
+            return -1;
+        done += ret;
+    }
+
+    return 0;
+}
+
+static void *producer(void *arg)
+{
+    struct worker *w = arg;
+    char msg[MSG_LEN];
+    double stamp = 0;
+    long i = 0;
+
+    pin(w->cpu);
+    memset(msg, 'p', sizeof(msg));
+
+    for (i = 0; i < w->messages; i++) {
+        stamp = now_ns();
+        memcpy(msg, &stamp, sizeof(stamp));
+        if (xfer(w->fd, msg, MSG_LEN, 1)) {
+            printf("producer write failed\n");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct worker *w = arg;
+    char msg[MSG_LEN];
+    double stamp = 0;
+    double lat = 0;
+    long i = 0;
+
+    pin(w->cpu);
+
+    for (i = 0; i < w->messages; i++) {
+        if (xfer(w->fd, msg, MSG_LEN, 0)) {
+            printf("consumer read failed\n");
+            break;
+        }
+        memcpy(&stamp, msg, sizeof(stamp));
+        lat = now_ns() - stamp;
+        w->sum_lat += lat;
+        if (lat > w->max_lat)
+            w->max_lat = lat;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct worker prod;
+    struct worker cons;
+    pthread_t tp;
+    pthread_t tc;
+    unsigned long mode = 0;
+    double start = 0;
+    double spent = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <mutex|spsc> [messages] [producer_cpu] "
+            "[consumer_cpu]\n", argv[0]);
+        return -1;
+    }
+
+    if (strcmp(argv[1], "spsc") == 0)
+        mode = GLOBALFIFO_MODE_SPSC;
+
+    memset(&prod, 0, sizeof(prod));
+    memset(&cons, 0, sizeof(cons));
+    prod.messages = cons.messages = argc > 2 ? atol(argv[2]) : 1000000;
+    prod.cpu = argc > 3 ? atoi(argv[3]) : 0;
+    cons.cpu = argc > 4 ? atoi(argv[4]) : 1;
+
+    /* the mode can only be changed while we are the sole opener */
+    prod.fd = open(DEV_NAME, O_WRONLY);
+    if (prod.fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    if (ioctl(prod.fd, GLOBALFIFO_IOC_SET_MODE, mode)) {
+        printf("set mode %s failed, is %s in use?\n", argv[1], DEV_NAME);
+        close(prod.fd);
+        return -1;
+    }
+
+    cons.fd = open(DEV_NAME, O_RDONLY);
+    if (cons.fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        close(prod.fd);
+        return -1;
+    }
+    ioctl(cons.fd, GLOBALFIFO_IOC_CLEAR);
+
+    start = now_ns();
+    pthread_create(&tc, NULL, consumer, &cons);
+    pthread_create(&tp, NULL, producer, &prod);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    spent = (now_ns() - start) / 1e9;
+
+    printf("%s: %ld messages of %d bytes in %.3f s\n",
+        argv[1], cons.messages, MSG_LEN, spent);
+    printf("%.0f msgs/s, %.2f MiB/s\n", cons.messages / spent,
+        cons.messages * MSG_LEN / spent / (1024 * 1024));
+    printf("latency avg %.0f ns, max %.0f ns\n",
+        cons.sum_lat / cons.messages, cons.max_lat);
+
+    close(cons.fd);
+    ioctl(prod.fd, GLOBALFIFO_IOC_SET_MODE, 0);
+    close(prod.fd);
+    return 0;
+}
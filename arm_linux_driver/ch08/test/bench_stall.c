@@ -0,0 +1,139 @@
+/*
+ * Producer stall time versus FIFO size.
+ *
+ * A producer writes BURST_LEN byte bursts every BURST_GAP_US into
+ * /dev/globalfifo0 while a consumer drains READ_LEN bytes every
+ * READ_GAP_US, so the average rates match but the producer is bursty.
+ * For each FIFO size the time the producer spends blocked in write()
+ * is reported.
+ *
+ * usage: bench_stall [bursts]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME        "/dev/globalfifo0"
+#define BURST_LEN       (256 * 1024)
+#define BURST_GAP_US    16000
+#define READ_LEN        4096
+#define READ_GAP_US     250
+
+struct bench {
+    int rfd;
+    int wfd;
+    int bursts;
+    long total;
+    double stall;
+    double worst;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg)
+{
+    struct bench *b = arg;
+    char *buf = malloc(BURST_LEN);
+    double start = 0;
+    double spent = 0;
+    size_t done = 0;
+    ssize_t ret = 0;
+    int i = 0;
+
+    memset(buf, 'b', BURST_LEN);
+
+    for (i = 0; i < b->bursts; i++) {
+        start = now_sec();
+        for (done = 0; done < BURST_LEN; done += ret) {
+            ret = write(b->wfd, buf + done, BURST_LEN - done);
+            if (ret <= 0)
+                goto out;
+        }
+        spent = now_sec() - start;
+
+        b->stall += spent;
+        if (spent > b->worst)
+            b->worst = spent;
+        usleep(BURST_GAP_US);
+    }
+
+out:
+    free(buf);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct bench *b = arg;
+    char buf[READ_LEN];
+    long left = b->total;
+    ssize_t ret = 0;
+
+    while (left > 0) {
+        ret = read(b->rfd, buf, READ_LEN);
+        if (ret <= 0)
+            break;
+        left -= ret;
+        usleep(READ_GAP_US);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned int sizes[] = {
+        4096, 16384, 65536, 262144, 1048576, 4194304,
+    };
+    struct bench b;
+    pthread_t tp;
+    pthread_t tc;
+    unsigned int i = 0;
+    int bursts = argc > 1 ? atoi(argv[1]) : 64;
+
+    printf("%10s %12s %12s %12s\n", "fifo", "stall ms", "per burst", "worst ms");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        memset(&b, 0, sizeof(b));
+        b.bursts = bursts;
+        b.total = (long)bursts * BURST_LEN;
+
+        b.wfd = open(DEV_NAME, O_WRONLY);
+        b.rfd = open(DEV_NAME, O_RDONLY);
+        if (b.wfd < 0 || b.rfd < 0) {
+            printf("open %s failed\n", DEV_NAME);
+            return -1;
+        }
+
+        ioctl(b.rfd, GLOBALFIFO_IOC_CLEAR);
+        if (ioctl(b.wfd, GLOBALFIFO_IOC_RESIZE, sizes[i])) {
+            printf("resize to %u failed\n", sizes[i]);
+            return -1;
+        }
+
+        pthread_create(&tc, NULL, consumer, &b);
+        pthread_create(&tp, NULL, producer, &b);
+        pthread_join(tp, NULL);
+        pthread_join(tc, NULL);
+
+        printf("%10u %12.1f %12.3f %12.3f\n", sizes[i], b.stall * 1e3,
+            b.stall * 1e3 / bursts, b.worst * 1e3);
+
+        close(b.rfd);
+        close(b.wfd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Read completion latency on /dev/globalfifo0: the epoll loop of
+ * test_epoll.c against io_uring.
+ *
+ * A producer thread writes an 8-byte CLOCK_MONOTONIC stamp every
+ * interval; the consumer reads them one at a time and records how long
+ * each took to arrive. The consumer runs three ways:
+ *
+ *   epoll        O_NONBLOCK fd, epoll_wait() then read() until EAGAIN
+ *   uring        blocking fd, one IORING_OP_READ at a time; the driver
+ *                takes IOCB_NOWAIT, so the read completes inline or is
+ *                retried from io_uring's poll handler
+ *   uring-async  the same with IOSQE_ASYNC, forcing every read out to an
+ *                io-wq worker as happens to files without FMODE_NOWAIT
+ *
+ * Alongside the latency percentiles the consumer's voluntary context
+ * switches per message are shown. io_uring is driven through the raw
+ * system calls, so liburing is not needed.
+ *
+ * usage: bench_uring [messages] [interval_us]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+
+enum { MODE_EPOLL, MODE_URING, MODE_URING_ASYNC, NR_MODES };
+
+static const char *mode_names[NR_MODES] = { "epoll", "uring", "uring-async" };
+
+struct uring {
+    int fd;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+static long nr_msgs = 100000;
+static long interval_ns = 50000;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int uring_init(struct uring *r, unsigned int entries)
+{
+    struct io_uring_params p;
+    size_t sq_len = 0;
+    size_t cq_len = 0;
+    char *sq = NULL;
+    char *cq = NULL;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/* submit one read at the file position and wait for its completion */
+static int uring_read(struct uring *r, int fd, void *buf, unsigned int len,
+    unsigned int flags)
+{
+    unsigned int tail = *r->sq_tail;
+    unsigned int idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    unsigned int submit = 1;
+    unsigned int head = 0;
+    int res = 0;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = -1;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;) {
+        head = *r->cq_head;
+        if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        res = syscall(__NR_io_uring_enter, r->fd, submit, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if (res < 0 && errno != EINTR)
+            return -errno;
+        if (res > 0)
+            submit = 0;
+    }
+
+    res = r->cqes[head & *r->cq_mask].res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+static void *producer(void *arg)
+{
+    int fd = *(int *)arg;
+    struct timespec gap = { 0, interval_ns };
+    uint64_t stamp = 0;
+    long i = 0;
+
+    for (i = 0; i < nr_msgs; i++) {
+        stamp = now_ns();
+        if (write(fd, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+            printf("write failed\n");
+            break;
+        }
+        nanosleep(&gap, NULL);
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* the consumer side of one run, filling lat[] */
+static long consume(int mode, int fd, uint64_t *lat)
+{
+    struct epoll_event ev;
+    struct uring r;
+    uint64_t stamp = 0;
+    long n = 0;
+    int epfd = -1;
+    int ret = 0;
+
+    memset(&r, 0, sizeof(r));
+    if (mode == MODE_EPOLL) {
+        epfd = epoll_create1(0);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+            printf("epoll setup failed\n");
+            return 0;
+        }
+    } else if (uring_init(&r, 4)) {
+        printf("io_uring setup failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    while (n < nr_msgs) {
+        if (mode == MODE_EPOLL) {
+            if (epoll_wait(epfd, &ev, 1, -1) < 0)
+                break;
+            while (n < nr_msgs &&
+                read(fd, &stamp, sizeof(stamp)) == sizeof(stamp))
+                lat[n++] = now_ns() - stamp;
+            continue;
+        }
+
+        ret = uring_read(&r, fd, &stamp, sizeof(stamp),
+            mode == MODE_URING_ASYNC ? IOSQE_ASYNC : 0);
+        if (ret != sizeof(stamp)) {
+            printf("io_uring read returned %d\n", ret);
+            break;
+        }
+        lat[n++] = now_ns() - stamp;
+    }
+
+    if (epfd >= 0)
+        close(epfd);
+    if (mode != MODE_EPOLL)
+        close(r.fd);
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    struct rusage before;
+    struct rusage after;
+    pthread_t tid;
+    uint64_t *lat = NULL;
+    long n = 0;
+    int mode = 0;
+    int rfd = -1;
+    int wfd = -1;
+
+    if (argc > 1)
+        nr_msgs = atol(argv[1]);
+    if (argc > 2)
+        interval_ns = atol(argv[2]) * 1000;
+    if (nr_msgs < 1 || interval_ns < 0 || interval_ns >= 1000000000) {
+        printf("usage: %s [messages] [interval_us]\n", argv[0]);
+        return -1;
+    }
+
+    lat = calloc(nr_msgs, sizeof(*lat));
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (!lat || wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    printf("%ld messages, one every %ld us\n", nr_msgs, interval_ns / 1000);
+    printf("%12s %10s %10s %10s %10s %10s\n", "consumer", "p50 us", "p99 us",
+        "p99.9 us", "max us", "csw/msg");
+
+    for (mode = 0; mode < NR_MODES; mode++) {
+        rfd = open(DEV_NAME,
+            O_RDONLY | (mode == MODE_EPOLL ? O_NONBLOCK : 0));
+        if (rfd < 0) {
+            printf("open %s failed\n", DEV_NAME);
+            break;
+        }
+        ioctl(rfd, GLOBALFIFO_IOC_CLEAR);
+
+        getrusage(RUSAGE_THREAD, &before);
+        pthread_create(&tid, NULL, producer, &wfd);
+        n = consume(mode, rfd, lat);
+        pthread_join(tid, NULL);
+        getrusage(RUSAGE_THREAD, &after);
+        close(rfd);
+
+        if (n == 0)
+            continue;
+        qsort(lat, n, sizeof(*lat), cmp_u64);
+        printf("%12s %10.1f %10.1f %10.1f %10.1f %10.2f\n", mode_names[mode],
+            lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3,
+            lat[n * 999 / 1000] / 1e3, lat[n - 1] / 1e3,
+            (double)(after.ru_nvcsw - before.ru_nvcsw) / n);
+    }
+
+    free(lat);
+    close(wfd);
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Wakeups and context switches per MiB at different watermark settings.
+ *
+ * A child process writes MSG_LEN byte messages into /dev/globalfifo0
+ * while the parent waits in epoll_wait() and drains whatever is queued
+ * each time it is woken. For every setting the number of epoll wakeups
+ * and the context switches of both sides are reported per MiB moved.
+ *
+ * usage: bench_wmark [MiB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define FIFO_LEN    4096
+#define MSG_LEN     64
+#define ANY_SPACE   GLOBALFIFO_MAX_SIZE
+
+static const struct globalfifo_wmark settings[] = {
+    { ANY_SPACE, 1, 0 },
+    { ANY_SPACE, 256, 10 },
+    { ANY_SPACE, 1024, 10 },
+    { ANY_SPACE, 2048, 10 },
+    { 2048, 2048, 10 },
+    { 1024, 3072, 10 },
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void produce(size_t total)
+{
+    char msg[MSG_LEN];
+    size_t done = 0;
+    ssize_t ret = 0;
+    int fd = open(DEV_NAME, O_WRONLY);
+
+    if (fd < 0)
+        exit(1);
+
+    memset(msg, 'w', sizeof(msg));
+    for (done = 0; done < total; done += ret) {
+        ret = write(fd, msg, MSG_LEN);
+        if (ret <= 0)
+            exit(1);
+    }
+
+    close(fd);
+    exit(0);
+}
+
+static long csw(const struct rusage *ru)
+{
+    return ru->ru_nvcsw + ru->ru_nivcsw;
+}
+
+int main(int argc, char *argv[])
+{
+    static char buf[FIFO_LEN];
+    struct globalfifo_wmark defaults = { ANY_SPACE, 1, 0 };
+    struct epoll_event ev;
+    struct rusage before;
+    struct rusage after;
+    struct rusage child;
+    size_t mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+    size_t total = mib << 20;
+    size_t done = 0;
+    long wakeups = 0;
+    double start = 0;
+    double spent = 0;
+    ssize_t ret = 0;
+    unsigned int i = 0;
+    int status = 0;
+    int fd = -1;
+    int ep = -1;
+    pid_t pid = 0;
+
+    fd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    if (ioctl(fd, GLOBALFIFO_IOC_RESIZE, FIFO_LEN))
+        printf("resize to %d failed, results assume %d bytes\n",
+            FIFO_LEN, FIFO_LEN);
+
+    ep = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev)) {
+        printf("epoll setup failed\n");
+        return -1;
+    }
+
+    printf("%6s %6s %6s %10s %12s %12s %10s\n", "low", "high", "ms",
+        "MiB/s", "wakeups/MiB", "rd csw/MiB", "wr csw/MiB");
+
+    for (i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        ioctl(fd, GLOBALFIFO_IOC_CLEAR);
+        if (ioctl(fd, GLOBALFIFO_IOC_SET_WMARK, &settings[i])) {
+            printf("GLOBALFIFO_IOC_SET_WMARK failed\n");
+            return -1;
+        }
+
+        done = 0;
+        wakeups = 0;
+        getrusage(RUSAGE_SELF, &before);
+        start = now_sec();
+
+        pid = fork();
+        if (pid < 0) {
+            printf("fork failed\n");
+            return -1;
+        }
+        if (pid == 0)
+            produce(total);
+
+        while (done < total) {
+            if (epoll_wait(ep, &ev, 1, -1) <= 0)
+                continue;
+            wakeups++;
+
+            while ((ret = read(fd, buf, sizeof(buf))) > 0)
+                done += ret;
+            if (ret < 0 && errno != EAGAIN)
+                break;
+        }
+
+        spent = now_sec() - start;
+        getrusage(RUSAGE_SELF, &after);
+        wait4(pid, &status, 0, &child);
+
+        printf("%6u %6u %6u %10.1f %12.1f %12.1f %10.1f\n",
+            settings[i].low == ANY_SPACE ? FIFO_LEN - 1 : settings[i].low,
+            settings[i].high, settings[i].timeout_ms, mib / spent,
+            (double)wakeups / mib, (double)(csw(&after) - csw(&before)) / mib,
+            (double)csw(&child) / mib);
+    }
+
+    ioctl(fd, GLOBALFIFO_IOC_SET_WMARK, &defaults);
+    close(ep);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "globalfifo_ring.h"
+
+int globalfifo_ring_open(struct globalfifo_ring *ring, const char *name)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    memset(ring, 0, sizeof(*ring));
+
+    /* a shared writable mapping needs the file open for writing */
+    ring->fd = open(name, O_RDWR | O_NONBLOCK);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->ctrl_len = page;
+    ring->ctrl = mmap(NULL, ring->ctrl_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED, ring->fd, 0);
+    if (ring->ctrl == MAP_FAILED)
+        goto fail_close;
+
+    ring->size = ring->ctrl->size;
+    ring->data_len = (ring->size + page - 1) & ~(page - 1);
+    ring->data = mmap(NULL, ring->data_len, PROT_READ, MAP_SHARED,
+        ring->fd, page);
+    if (ring->data == MAP_FAILED)
+        goto fail_unmap;
+
+    return 0;
+
+fail_unmap:
+    munmap(ring->ctrl, ring->ctrl_len);
+fail_close:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+void globalfifo_ring_close(struct globalfifo_ring *ring)
+{
+    if (ring->fd < 0)
+        return;
+
+    munmap(ring->data, ring->data_len);
+    munmap(ring->ctrl, ring->ctrl_len);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+size_t globalfifo_ring_peek(struct globalfifo_ring *ring, const void **p,
+    size_t *chunk)
+{
+    unsigned int head = __atomic_load_n(&ring->ctrl->head, __ATOMIC_ACQUIRE);
+    unsigned int tail = ring->ctrl->tail;
+    unsigned int off = tail & (ring->size - 1);
+    size_t len = head - tail;
+
+    *p = ring->data + off;
+    *chunk = len < ring->size - off ? len : ring->size - off;
+    return len;
+}
+
+void globalfifo_ring_consume(struct globalfifo_ring *ring, size_t n)
+{
+    __atomic_store_n(&ring->ctrl->tail, ring->ctrl->tail + n,
+        __ATOMIC_RELEASE);
+
+    /* pairs with the barrier a writer issues after setting the flag */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->ctrl->writer_waiting, __ATOMIC_RELAXED)) {
+        ioctl(ring->fd, GLOBALFIFO_IOC_RING_WAKE);
+        ring->syscalls++;
+    }
+}
+
+size_t globalfifo_ring_read(struct globalfifo_ring *ring, void *buf,
+    size_t len)
+{
+    const void *p = NULL;
+    size_t chunk = 0;
+    size_t avail = globalfifo_ring_peek(ring, &p, &chunk);
+    size_t n = 0;
+
+    if (len > avail)
+        len = avail;
+
+    n = len < chunk ? len : chunk;
+    memcpy(buf, p, n);
+    memcpy((char *)buf + n, ring->data, len - n);
+
+    globalfifo_ring_consume(ring, len);
+    return len;
+}
+
+int globalfifo_ring_wait(struct globalfifo_ring *ring, int timeout_ms)
+{
+    struct pollfd pfd;
+    const void *p = NULL;
+    size_t chunk = 0;
+
+    if (globalfifo_ring_peek(ring, &p, &chunk))
+        return 1;
+
+    pfd.fd = ring->fd;
+    pfd.events = POLLIN | POLLRDNORM;
+    pfd.revents = 0;
+
+    ring->syscalls++;
+    return poll(&pfd, 1, timeout_ms);
+}
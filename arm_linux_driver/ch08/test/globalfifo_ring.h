@@ -0,0 +1,39 @@
+/*
+ * User-space consumer for the globalfifo mmap ring.
+ *
+ * Data is drained in place from the mapping; the driver is only entered
+ * to sleep in poll() when the ring is empty, or to wake writers that
+ * blocked on a full ring.
+ */
+#ifndef GLOBALFIFO_RING_H
+#define GLOBALFIFO_RING_H
+
+#include <stddef.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+struct globalfifo_ring {
+    int fd;
+    struct globalfifo_ring_ctrl *ctrl;
+    unsigned char *data;
+    size_t ctrl_len;
+    size_t data_len;
+    unsigned int size;
+    unsigned long syscalls;
+};
+
+int globalfifo_ring_open(struct globalfifo_ring *ring, const char *name);
+void globalfifo_ring_close(struct globalfifo_ring *ring);
+
+/* bytes ready to consume; *p points at the first contiguous chunk */
+size_t globalfifo_ring_peek(struct globalfifo_ring *ring, const void **p,
+    size_t *chunk);
+void globalfifo_ring_consume(struct globalfifo_ring *ring, size_t n);
+
+/* copy up to len bytes out of the ring, returns the number copied */
+size_t globalfifo_ring_read(struct globalfifo_ring *ring, void *buf,
+    size_t len);
+
+/* sleep until data is ready: 1 ready, 0 timeout, -1 error */
+int globalfifo_ring_wait(struct globalfifo_ring *ring, int timeout_ms);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Live view of all globalfifo devices, refreshed every interval.
+ *
+ * Rates are computed from GLOBALFIFO_IOC_GET_STATS deltas between two
+ * samples; "r wait" and "w wait" are the average time a blocked reader
+ * or writer spent asleep during the interval.
+ *
+ * The devices are opened with access mode 3, which Linux treats as
+ * ioctl-only, so the tool is not counted as a reader or writer and does
+ * not collide with the one-reader/one-writer rule of SPSC mode. It does
+ * count as an opener, so stop it before changing a device's mode.
+ *
+ * usage: globalfifo_top [interval_s] [iterations] [-r]
+ *   -r  reset the counters of every device before the first sample
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define MIB     (1024.0 * 1024.0)
+
+static double per_wait_us(__u64 ns, __u64 waits)
+{
+    return waits ? ns / 1e3 / waits : 0;
+}
+
+static void show(int dev, const struct globalfifo_stats *old,
+    const struct globalfifo_stats *cur, double interval)
+{
+    __u64 r_waits = cur->r_waits - old->r_waits;
+    __u64 w_waits = cur->w_waits - old->w_waits;
+
+    printf("%3d %9u %9u %9u %9.2f %9.2f %8.0f %8.0f %8.1f %8.1f %8.0f\n",
+        dev, cur->size, cur->len, cur->high_water,
+        (cur->bytes_read - old->bytes_read) / MIB / interval,
+        (cur->bytes_written - old->bytes_written) / MIB / interval,
+        (cur->reads - old->reads) / interval,
+        (cur->writes - old->writes) / interval,
+        per_wait_us(cur->r_wait_ns - old->r_wait_ns, r_waits),
+        per_wait_us(cur->w_wait_ns - old->w_wait_ns, w_waits),
+        (cur->eagain - old->eagain) / interval);
+}
+
+int main(int argc, char *argv[])
+{
+    int fds[GLOBALFIFO_DEV_NUM];
+    struct globalfifo_stats old[GLOBALFIFO_DEV_NUM];
+    struct globalfifo_stats cur;
+    char name[32];
+    int interval = argc > 1 ? atoi(argv[1]) : 1;
+    int iterations = argc > 2 ? atoi(argv[2]) : -1;
+    int reset = argc > 3 && strcmp(argv[3], "-r") == 0;
+    int opened = 0;
+    int i = 0;
+
+    if (interval <= 0)
+        interval = 1;
+
+    for (i = 0; i < GLOBALFIFO_DEV_NUM; i++) {
+        snprintf(name, sizeof(name), "/dev/globalfifo%d", i);
+        fds[i] = open(name, 3 | O_NONBLOCK);
+        if (fds[i] < 0)
+            continue;
+        opened++;
+
+        if (reset)
+            ioctl(fds[i], GLOBALFIFO_IOC_RESET_STATS);
+        if (ioctl(fds[i], GLOBALFIFO_IOC_GET_STATS, &old[i])) {
+            printf("%s does not support GLOBALFIFO_IOC_GET_STATS\n", name);
+            close(fds[i]);
+            fds[i] = -1;
+            opened--;
+        }
+    }
+
+    if (opened == 0) {
+        printf("no /dev/globalfifoN device could be opened\n");
+        return -1;
+    }
+
+    while (iterations < 0 || iterations-- > 0) {
+        sleep(interval);
+
+        /* clear the screen and home the cursor */
+        printf("\033[H\033[2J");
+        printf("globalfifo every %d s\n\n", interval);
+        printf("%3s %9s %9s %9s %9s %9s %8s %8s %8s %8s %8s\n",
+            "dev", "size", "len", "high", "rd MiB/s", "wr MiB/s",
+            "reads/s", "writes/s", "r wait", "w wait", "EAGAIN/s");
+
+        for (i = 0; i < GLOBALFIFO_DEV_NUM; i++) {
+            if (fds[i] < 0)
+                continue;
+            if (ioctl(fds[i], GLOBALFIFO_IOC_GET_STATS, &cur))
+                continue;
+            show(i, &old[i], &cur, interval);
+            old[i] = cur;
+        }
+        printf("\n(wait columns are average microseconds per blocked call)\n");
+        fflush(stdout);
+    }
+
+    for (i = 0; i < GLOBALFIFO_DEV_NUM; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Thundering herd check: NR_READERS threads block on /dev/globalfifo0
+ * while the main thread sends paced MSG_LEN byte records, so every
+ * message finds all readers asleep.
+ *
+ * read:     each reader blocks in read()
+ * epoll:    each reader has its own epoll instance watching its own
+ *           O_NONBLOCK descriptor for EPOLLIN
+ * epollex:  as epoll, with EPOLLEXCLUSIVE
+ *
+ * Reported are the wakeups per message (voluntary context switches of
+ * the reader threads for read, epoll_wait() returns for the epoll
+ * modes) and the reads that found nothing. With exclusive waits each
+ * message should wake about one reader.
+ *
+ * usage: test_herd <read|epoll|epollex> [messages]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define NR_READERS  16
+#define MSG_LEN     64
+#define PACE_US     1000
+
+struct reader {
+    pthread_t tid;
+    int fd;
+    int ep;
+    long msgs;
+    long wakeups;
+    long empty;
+};
+
+/* a record starting with 'q' tells the reader that gets it to stop */
+static int got_stop(const char *msg, ssize_t ret)
+{
+    return ret > 0 && msg[0] == 'q';
+}
+
+static void *read_thread(void *arg)
+{
+    struct reader *r = arg;
+    struct rusage before;
+    struct rusage after;
+    char msg[MSG_LEN];
+    ssize_t ret = 0;
+
+    getrusage(RUSAGE_THREAD, &before);
+    for (;;) {
+        ret = read(r->fd, msg, sizeof(msg));
+        if (ret <= 0) {
+            printf("read failed: %s\n", strerror(errno));
+            break;
+        }
+        if (got_stop(msg, ret))
+            break;
+        r->msgs++;
+    }
+    getrusage(RUSAGE_THREAD, &after);
+    r->wakeups = after.ru_nvcsw - before.ru_nvcsw;
+
+    return NULL;
+}
+
+static void *epoll_thread(void *arg)
+{
+    struct reader *r = arg;
+    struct epoll_event ev;
+    char msg[MSG_LEN];
+    ssize_t ret = 0;
+
+    while (ret >= 0) {
+        if (epoll_wait(r->ep, &ev, 1, -1) <= 0)
+            continue;
+        r->wakeups++;
+
+        /* drain until EAGAIN, someone else may have taken it already */
+        while ((ret = read(r->fd, msg, sizeof(msg))) > 0) {
+            if (got_stop(msg, ret))
+                goto out;
+            r->msgs++;
+        }
+        if (errno != EAGAIN)
+            printf("read failed: %s\n", strerror(errno));
+        else
+            r->empty++;
+        ret = errno == EAGAIN ? 0 : -1;
+    }
+
+out:
+    /* an exclusive entry left behind would keep taking wakeups */
+    close(r->ep);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct reader readers[NR_READERS];
+    struct epoll_event ev;
+    char msg[MSG_LEN];
+    long messages = argc > 2 ? atol(argv[2]) : 2000;
+    long msgs = 0;
+    long wakeups = 0;
+    long empty = 0;
+    int use_epoll = 0;
+    int ctl = -1;
+    int wfd = -1;
+    long i = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <read|epoll|epollex> [messages]\n", argv[0]);
+        return -1;
+    }
+    use_epoll = strncmp(argv[1], "epoll", 5) == 0;
+
+    /* record mode, so every read takes exactly one message */
+    ctl = open(DEV_NAME, O_RDONLY);
+    if (ctl < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(ctl, GLOBALFIFO_IOC_CLEAR);
+    if (ioctl(ctl, GLOBALFIFO_IOC_SET_MODE, GLOBALFIFO_MODE_RECORD)) {
+        printf("set record mode failed, is %s in use?\n", DEV_NAME);
+        close(ctl);
+        return -1;
+    }
+
+    wfd = open(DEV_NAME, O_WRONLY);
+    if (wfd < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    for (i = 0; i < NR_READERS; i++) {
+        readers[i].fd = open(DEV_NAME,
+            use_epoll ? O_RDONLY | O_NONBLOCK : O_RDONLY);
+        if (readers[i].fd < 0) {
+            printf("open %s failed\n", DEV_NAME);
+            return -1;
+        }
+        if (!use_epoll) {
+            pthread_create(&readers[i].tid, NULL, read_thread, &readers[i]);
+            continue;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        if (strcmp(argv[1], "epollex") == 0)
+            ev.events |= EPOLLEXCLUSIVE;
+        readers[i].ep = epoll_create1(0);
+        if (readers[i].ep < 0 ||
+            epoll_ctl(readers[i].ep, EPOLL_CTL_ADD, readers[i].fd, &ev)) {
+            printf("epoll setup failed: %s\n", strerror(errno));
+            return -1;
+        }
+        pthread_create(&readers[i].tid, NULL, epoll_thread, &readers[i]);
+    }
+
+    /* let every reader go to sleep before the first message */
+    usleep(100000);
+
+    memset(msg, 'm', sizeof(msg));
+    for (i = 0; i < messages; i++) {
+        if (write(wfd, msg, sizeof(msg)) != sizeof(msg)) {
+            printf("write failed\n");
+            break;
+        }
+        usleep(PACE_US);
+    }
+
+    msg[0] = 'q';
+    for (i = 0; i < NR_READERS; i++) {
+        write(wfd, msg, sizeof(msg));
+        usleep(PACE_US);
+    }
+
+    for (i = 0; i < NR_READERS; i++) {
+        pthread_join(readers[i].tid, NULL);
+        msgs += readers[i].msgs;
+        wakeups += readers[i].wakeups;
+        empty += readers[i].empty;
+        close(readers[i].fd);
+    }
+
+    printf("%s: %d readers, %ld of %ld messages received\n", argv[1],
+        NR_READERS, msgs, messages);
+    printf("%.2f wakeups/msg, %.2f empty reads/msg\n",
+        msgs ? (double)wakeups / msgs : 0, msgs ? (double)empty / msgs : 0);
+
+    close(wfd);
+    ioctl(ctl, GLOBALFIFO_IOC_SET_MODE, 0);
+    close(ctl);
+    return msgs == messages ? 0 : -1;
+}
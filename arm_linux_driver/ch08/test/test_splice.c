@@ -0,0 +1,209 @@
+/*
+ * Forward a sustained stream from /dev/globalfifo0 to a file, either
+ * with splice() through a pipe or with a read()/write() loop, and
+ * report the throughput. The output file is checked against the
+ * pattern the producer wrote.
+ *
+ * usage: test_splice <splice|rw> [MiB] [out_file] [fifo_size]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "../globalfifo_poll/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define OUT_FILE    "/dev/shm/globalfifo_splice.out"
+#define CHUNK       65536
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void produce(size_t total)
+{
+    int fd = -1;
+    size_t done = 0;
+    size_t i = 0;
+    size_t n = 0;
+    ssize_t ret = 0;
+    static unsigned char buf[CHUNK];
+
+    fd = open(DEV_NAME, O_WRONLY);
+    if (fd < 0)
+        exit(1);
+
+    while (done < total) {
+        n = total - done < CHUNK ? total - done : CHUNK;
+        for (i = 0; i < n; i++)
+            buf[i] = (unsigned char)(done + i);
+
+        ret = write(fd, buf, n);
+        if (ret <= 0)
+            exit(1);
+        done += ret;
+    }
+
+    close(fd);
+    exit(0);
+}
+
+static int forward_splice(int in, int out, size_t total)
+{
+    int pfd[2];
+    size_t done = 0;
+    ssize_t n = 0;
+    ssize_t m = 0;
+
+    if (pipe(pfd)) {
+        printf("pipe failed\n");
+        return -1;
+    }
+
+    while (done < total) {
+        n = splice(in, NULL, pfd[1], NULL, CHUNK, SPLICE_F_MOVE);
+        if (n <= 0)
+            break;
+
+        while (n > 0) {
+            m = splice(pfd[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+            if (m <= 0)
+                goto out;
+            n -= m;
+            done += m;
+        }
+    }
+
+out:
+    close(pfd[0]);
+    close(pfd[1]);
+    return done == total ? 0 : -1;
+}
+
+static int forward_rw(int in, int out, size_t total)
+{
+    static char buf[CHUNK];
+    size_t done = 0;
+    ssize_t n = 0;
+    ssize_t m = 0;
+    ssize_t ret = 0;
+
+    while (done < total) {
+        n = read(in, buf, CHUNK);
+        if (n <= 0)
+            break;
+
+        for (m = 0; m < n; m += ret) {
+            ret = write(out, buf + m, n - m);
+            if (ret <= 0)
+                return -1;
+        }
+        done += n;
+    }
+
+    return done == total ? 0 : -1;
+}
+
+static int verify(const char *name, size_t total)
+{
+    static unsigned char buf[CHUNK];
+    size_t off = 0;
+    ssize_t n = 0;
+    ssize_t i = 0;
+    int fd = open(name, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    while ((n = read(fd, buf, CHUNK)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (buf[i] != (unsigned char)(off + i)) {
+                close(fd);
+                return -1;
+            }
+        }
+        off += n;
+    }
+
+    close(fd);
+    return off == total ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int in = -1;
+    int out = -1;
+    int ret = 0;
+    int status = 0;
+    pid_t pid = 0;
+    size_t mib = argc > 2 ? strtoul(argv[2], NULL, 0) : 256;
+    const char *out_name = argc > 3 ? argv[3] : OUT_FILE;
+    size_t total = mib << 20;
+    double start = 0;
+    double spent = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <splice|rw> [MiB] [out_file] [fifo_size]\n",
+            argv[0]);
+        return -1;
+    }
+
+    in = open(DEV_NAME, O_RDONLY);
+    if (in < 0) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+    ioctl(in, GLOBALFIFO_IOC_CLEAR);
+    if (argc > 4 && ioctl(in, GLOBALFIFO_IOC_RESIZE, strtoul(argv[4], NULL, 0)))
+        printf("resize failed, keeping %ld bytes\n",
+            (long)ioctl(in, GLOBALFIFO_IOC_GET_SIZE));
+
+    out = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        printf("open %s failed\n", out_name);
+        close(in);
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        return -1;
+    }
+    if (pid == 0)
+        produce(total);
+
+    start = now_sec();
+    if (strcmp(argv[1], "splice") == 0)
+        ret = forward_splice(in, out, total);
+    else
+        ret = forward_rw(in, out, total);
+    spent = now_sec() - start;
+
+    if (ret)
+        kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    close(out);
+    close(in);
+
+    if (ret == 0 && verify(out_name, total)) {
+        printf("%s does not match the produced stream\n", out_name);
+        ret = -1;
+    }
+
+    printf("%s: %zu MiB in %.3f s, %.1f MiB/s%s\n", argv[1], mib, spent,
+        mib / spent, ret ? " (failed)" : "");
+
+    unlink(out_name);
+    return ret;
+}
@@ -10,25 +10,105 @@
 #include <linux/poll.h>
 #include "globalfifo.h"
 
+#define CREATE_TRACE_POINTS
+#include "globalfifo_trace.h"
+
 #define GLOBALFIFO_MAJOR    230
 
 #define GLOBALFIFO_SIZE     4096
 
+/* flags bits */
+#define GLOBALFIFO_COALESCE 0   /* one outstanding signal per band */
+#define GLOBALFIFO_SIG_IN   1   /* POLL_IN sent, no read() since */
+#define GLOBALFIFO_SIG_OUT  2   /* POLL_OUT sent, no write() since */
+
 static int globalfifo_major = GLOBALFIFO_MAJOR;
 module_param(globalfifo_major, int, S_IRUGO);
 
 struct globalfifo_dev {
     struct cdev cdev;
-    unsigned int current_len;
+    unsigned int head;
+    unsigned int tail;
     unsigned char fifo[GLOBALFIFO_SIZE];
     struct mutex mutex;
     wait_queue_head_t r_wait;
     wait_queue_head_t w_wait;
     struct fasync_struct *async_queue;
+    unsigned long flags;
 };
 
 struct globalfifo_dev *globalfifo_devp;
 
+/*
+ * head and tail run freely and are only masked when indexing fifo[],
+ * so GLOBALFIFO_SIZE must be a power of two.
+ */
+static inline unsigned int globalfifo_len(struct globalfifo_dev *dev)
+{
+    return dev->head - dev->tail;
+}
+
+static int globalfifo_copy_to_user(struct globalfifo_dev *dev,
+    char __user *buf, size_t size)
+{
+    unsigned int off = dev->tail & (GLOBALFIFO_SIZE - 1);
+    size_t n = min_t(size_t, size, GLOBALFIFO_SIZE - off);
+
+    if (copy_to_user(buf, dev->fifo + off, n))
+        return -EFAULT;
+    if (copy_to_user(buf + n, dev->fifo, size - n))
+        return -EFAULT;
+
+    return 0;
+}
+
+static int globalfifo_copy_from_user(struct globalfifo_dev *dev,
+    const char __user *buf, size_t size)
+{
+    unsigned int off = dev->head & (GLOBALFIFO_SIZE - 1);
+    size_t n = min_t(size_t, size, GLOBALFIFO_SIZE - off);
+
+    if (copy_from_user(dev->fifo + off, buf, n))
+        return -EFAULT;
+    if (copy_from_user(dev->fifo, buf + n, size - n))
+        return -EFAULT;
+
+    return 0;
+}
+
+/*
+ * Raise POLL_IN or POLL_OUT on the fasync queue, called with the mutex
+ * held. The signal number and siginfo come from each file's F_SETSIG
+ * setting. When coalescing, nothing is sent while the last signal of
+ * this band has not been collected yet.
+ */
+static void globalfifo_notify(struct globalfifo_dev *dev, int band)
+{
+    int bit = band == POLL_IN ? GLOBALFIFO_SIG_IN : GLOBALFIFO_SIG_OUT;
+
+    if (!dev->async_queue)
+        return;
+    if (test_bit(GLOBALFIFO_COALESCE, &dev->flags) &&
+        test_and_set_bit(bit, &dev->flags))
+        return;
+
+    kill_fasync(&dev->async_queue, SIGIO, band);
+    trace_globalfifo_kill_fasync(MINOR(dev->cdev.dev), band,
+        globalfifo_len(dev));
+}
+
+/*
+ * A read collects the outstanding POLL_IN. If data is left, the next one
+ * is raised at once, so a consumer that reads less than is queued is not
+ * left without a signal.
+ */
+static void globalfifo_collect(struct globalfifo_dev *dev)
+{
+    if (test_and_clear_bit(GLOBALFIFO_SIG_IN, &dev->flags) &&
+        globalfifo_len(dev) != 0)
+        globalfifo_notify(dev, POLL_IN);
+}
+
 static int globalfifo_fasync(int fd, struct file *filp, int mode)
 {
     struct globalfifo_dev *dev =
@@ -54,14 +134,35 @@ static long globalfifo_ioctl(struct file *filp,
     unsigned int cmd, unsigned long arg)
 {
     struct globalfifo_dev *dev = filp->private_data;
+    long ret = 0;
 
     switch (cmd) {
     case GLOBALFIFO_IOC_CLEAR:
         mutex_lock(&dev->mutex);
         memset(dev->fifo, 0, GLOBALFIFO_SIZE);
-        dev->current_len = 0;
+        dev->head = 0;
+        dev->tail = 0;
+        clear_bit(GLOBALFIFO_SIG_IN, &dev->flags);
+        clear_bit(GLOBALFIFO_SIG_OUT, &dev->flags);
+        mutex_unlock(&dev->mutex);
+        trace_globalfifo_clear(MINOR(dev->cdev.dev));
+        break;
+
+    case GLOBALFIFO_IOC_GET_LEN:
+        mutex_lock(&dev->mutex);
+        ret = globalfifo_len(dev);
+        mutex_unlock(&dev->mutex);
+        return ret;
+
+    case GLOBALFIFO_IOC_COALESCE:
+        mutex_lock(&dev->mutex);
+        if (arg)
+            set_bit(GLOBALFIFO_COALESCE, &dev->flags);
+        else
+            clear_bit(GLOBALFIFO_COALESCE, &dev->flags);
+        clear_bit(GLOBALFIFO_SIG_IN, &dev->flags);
+        clear_bit(GLOBALFIFO_SIG_OUT, &dev->flags);
         mutex_unlock(&dev->mutex);
-        printk(KERN_INFO "globalfifo is set to zero\n");
         break;
 
     default:
@@ -82,11 +183,11 @@ static unsigned int globalfifo_poll(struct file *filp,
     poll_wait(filp, &dev->r_wait, wait);
     poll_wait(filp, &dev->w_wait, wait);
 
-    if (dev->current_len != 0) {
+    if (globalfifo_len(dev) != 0) {
         mask |= POLLIN | POLLRDNORM;
     }
 
-    if (dev->current_len != GLOBALFIFO_SIZE) {
+    if (globalfifo_len(dev) != GLOBALFIFO_SIZE) {
         mask |= POLLOUT | POLLWRNORM;
     }
 
@@ -98,17 +199,20 @@ static ssize_t globalfifo_read(struct file *filp,
     char __user *buf, size_t size, loff_t *ppos)
 {
     int ret = 0;
+    bool full = false;
     struct globalfifo_dev *dev = filp->private_data;
 
     mutex_lock(&dev->mutex);
 
-    while (dev->current_len == 0) {
+    while (globalfifo_len(dev) == 0) {
         if (filp->f_flags & O_NONBLOCK) {
             ret = -EAGAIN;
             goto exit1;
         } else {
             mutex_unlock(&dev->mutex);
-            ret = wait_event_interruptible(dev->r_wait, (dev->current_len > 0));
+            trace_globalfifo_wait(MINOR(dev->cdev.dev), false);
+            ret = wait_event_interruptible(dev->r_wait,
+                (globalfifo_len(dev) > 0));
             if (ret == 0) {
                 mutex_lock(&dev->mutex);
             } else {
@@ -119,19 +223,24 @@ static ssize_t globalfifo_read(struct file *filp,
         }
     }
 
-    if (size > dev->current_len) {
-        size = dev->current_len;
+    if (size > globalfifo_len(dev)) {
+        size = globalfifo_len(dev);
     }
 
-    if (copy_to_user(buf, dev->fifo, size)) {
+    if (globalfifo_copy_to_user(dev, buf, size)) {
         printk(KERN_ERR "globalfifo copy driver data to user buffer failed\n");
         ret = -EFAULT;
     } else {
-        memcpy(dev->fifo, dev->fifo + size, dev->current_len - size);
-        dev->current_len -= size;
-        printk(KERN_INFO "globalfifo read %lu bytes, current_len: %u\n",
-            size, dev->current_len);
+        full = globalfifo_len(dev) == GLOBALFIFO_SIZE;
+        dev->tail += size;
+        trace_globalfifo_read(MINOR(dev->cdev.dev), size, globalfifo_len(dev));
+        trace_globalfifo_wakeup(MINOR(dev->cdev.dev), true);
         wake_up_interruptible(&dev->w_wait);
+
+        globalfifo_collect(dev);
+        if (full && size)
+            globalfifo_notify(dev, POLL_OUT);
+
         ret = size;
     }
 
@@ -149,14 +258,15 @@ static ssize_t globalfifo_write(struct file *filp,
 
     mutex_lock(&dev->mutex);
 
-    while (dev->current_len == GLOBALFIFO_SIZE) {
+    while (globalfifo_len(dev) == GLOBALFIFO_SIZE) {
         if (filp->f_flags & O_NONBLOCK) {
             ret = -EAGAIN;
             goto exit1;
         } else {
             mutex_unlock(&dev->mutex);
+            trace_globalfifo_wait(MINOR(dev->cdev.dev), true);
             ret = wait_event_interruptible(dev->w_wait,
-                (dev->current_len < GLOBALFIFO_SIZE));
+                (globalfifo_len(dev) < GLOBALFIFO_SIZE));
             if (ret == 0) {
                 mutex_lock(&dev->mutex);
             } else {
@@ -167,23 +277,22 @@ static ssize_t globalfifo_write(struct file *filp,
         }
     }
 
-    if (size > GLOBALFIFO_SIZE - dev->current_len) {
-        size = GLOBALFIFO_SIZE - dev->current_len;
+    if (size > GLOBALFIFO_SIZE - globalfifo_len(dev)) {
+        size = GLOBALFIFO_SIZE - globalfifo_len(dev);
     }
 
-    if (copy_from_user(dev->fifo + dev->current_len, buf, size)) {
+    if (globalfifo_copy_from_user(dev, buf, size)) {
         printk(KERN_ERR "globalfifo copy user data to driver buffer failed\n");
         ret = -EFAULT;
     } else {
-        dev->current_len += size;
-        printk(KERN_INFO "globalfifo write %lu bytes, current_len: %u\n",
-            size, dev->current_len);
+        dev->head += size;
+        trace_globalfifo_write(MINOR(dev->cdev.dev), size, globalfifo_len(dev));
+        trace_globalfifo_wakeup(MINOR(dev->cdev.dev), false);
         wake_up_interruptible(&dev->r_wait);
 
-        if (dev->async_queue) {
-            kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
-            printk(KERN_INFO "%s kill SIGIO\n", __func__);
-        }
+        /* a write collects the outstanding POLL_OUT */
+        clear_bit(GLOBALFIFO_SIG_OUT, &dev->flags);
+        globalfifo_notify(dev, POLL_IN);
 
         ret = size;
     }
@@ -5,3 +5,25 @@
 #define GLOBALFIFO_TYPE         'G'
 
 #define GLOBALFIFO_IOC_CLEAR    _IO(GLOBALFIFO_TYPE, 1)
+
+/*
+ * Returns the number of bytes queued, so a signal handler can read
+ * exactly that much instead of calling read() until it fails.
+ */
+#define GLOBALFIFO_IOC_GET_LEN  _IO(GLOBALFIFO_TYPE, 2)
+
+/*
+ * With O_ASYNC set, a write() raises POLL_IN and a read() that frees
+ * space in a full FIFO raises POLL_OUT. After fcntl(F_SETSIG) with a
+ * realtime signal each one is queued with si_code POLL_IN or POLL_OUT,
+ * si_band the matching poll events and si_fd the descriptor; without it
+ * a plain SIGIO is sent.
+ *
+ * GLOBALFIFO_IOC_COALESCE with a non-zero arg keeps at most one POLL_IN
+ * and one POLL_OUT outstanding per device. After a POLL_IN the next is
+ * raised by a read() that leaves data queued, or by the first write()
+ * after a read(); after a POLL_OUT, by a read() once a write() has been
+ * made. A burst of writes then cannot overflow the realtime signal
+ * queue, which would make the kernel fall back to a plain SIGIO.
+ */
+#define GLOBALFIFO_IOC_COALESCE _IO(GLOBALFIFO_TYPE, 3)
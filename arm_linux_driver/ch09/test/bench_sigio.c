@@ -0,0 +1,233 @@
+/*
+ * Notification latency and signals per MiB for /dev/globalfifo0's
+ * asynchronous notification.
+ *
+ * A producer thread writes 8-byte CLOCK_MONOTONIC stamps in bursts of
+ * burst writes, pausing interval between bursts. The consumer takes the
+ * signals with sigwaitinfo() and reads what arrived, three ways:
+ *
+ *   sigio        plain SIGIO, reading BUF_LEN bytes at a time until
+ *                read() fails, as test.c does
+ *   rt           F_SETSIG to SIGRTMIN; GLOBALFIFO_IOC_GET_LEN, then a
+ *                single read() of exactly that much
+ *   rt-coalesce  the same with GLOBALFIFO_IOC_COALESCE
+ *
+ * Latency is from the write of the oldest stamp a signal finds to the
+ * consumer having the signal. A plain SIGIO taken in the rt modes means
+ * the realtime signal queue overflowed.
+ *
+ * usage: bench_sigio [MiB] [burst] [interval_us]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../globalfifo_signal/globalfifo.h"
+
+#define DEV_NAME    "/dev/globalfifo0"
+#define BUF_LEN     16
+#define FIFO_LEN    4096
+
+enum { MODE_SIGIO, MODE_RT, MODE_RT_COALESCE, NR_MODES };
+
+static const char *mode_names[NR_MODES] = { "sigio", "rt", "rt-coalesce" };
+
+static long nr_stamps;
+static long burst = 16;
+static long interval_ns = 100000;
+
+struct result {
+    long signals;
+    long overflows;
+    long syscalls;
+    long nr_lat;
+    uint64_t *lat;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *producer(void *arg)
+{
+    int fd = *(int *)arg;
+    struct timespec gap = { 0, interval_ns };
+    uint64_t stamp = 0;
+    long i = 0;
+
+    for (i = 0; i < nr_stamps; i++) {
+        stamp = now_ns();
+        if (write(fd, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+            printf("write failed\n");
+            break;
+        }
+        if (interval_ns && (i + 1) % burst == 0)
+            nanosleep(&gap, NULL);
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* take signals until every stamp is read, returns the stamps read */
+static long consume(int mode, int fd, struct result *res)
+{
+    struct timespec timeout = { 1, 0 };
+    uint64_t buf[FIFO_LEN / sizeof(uint64_t)];
+    siginfo_t si;
+    sigset_t set;
+    uint64_t t = 0;
+    long got = 0;
+    long len = 0;
+    ssize_t n = 0;
+    int first = 0;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGIO);
+    sigaddset(&set, SIGRTMIN);
+
+    while (got < nr_stamps) {
+        if (sigtimedwait(&set, &si, &timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("%s: no signal for a second, %ld of %ld stamps read\n",
+                mode_names[mode], got, nr_stamps);
+            break;
+        }
+        t = now_ns();
+        res->signals++;
+        first = 1;
+
+        if (si.si_signo == SIGIO) {
+            if (mode != MODE_SIGIO)
+                res->overflows++;
+            do {
+                n = read(fd, buf, BUF_LEN);
+                res->syscalls++;
+                if (n > 0 && first)
+                    res->lat[res->nr_lat++] = t - buf[0];
+                if (n > 0)
+                    got += n / sizeof(uint64_t);
+                first = 0;
+            } while (n > 0);
+            continue;
+        }
+
+        /* POLL_OUT is raised for the writer's side, nothing to read */
+        if (si.si_code != POLL_IN)
+            continue;
+
+        len = ioctl(fd, GLOBALFIFO_IOC_GET_LEN);
+        res->syscalls++;
+        if (len <= 0)
+            continue;
+        n = read(fd, buf, len);
+        res->syscalls++;
+        if (n > 0) {
+            res->lat[res->nr_lat++] = t - buf[0];
+            got += n / sizeof(uint64_t);
+        }
+    }
+
+    return got;
+}
+
+int main(int argc, char *argv[])
+{
+    struct result res;
+    sigset_t set;
+    pthread_t tid;
+    double mib = argc > 1 ? atof(argv[1]) : 1;
+    int mode = 0;
+    int rfd = -1;
+    int wfd = -1;
+
+    if (argc > 2)
+        burst = atol(argv[2]);
+    if (argc > 3)
+        interval_ns = atol(argv[3]) * 1000;
+    nr_stamps = mib * (1 << 20) / sizeof(uint64_t);
+    if (nr_stamps < 1 || burst < 1 || interval_ns < 0 ||
+        interval_ns >= 1000000000) {
+        printf("usage: %s [MiB] [burst] [interval_us]\n", argv[0]);
+        return -1;
+    }
+
+    /* blocked everywhere, so only sigtimedwait() takes them */
+    sigemptyset(&set);
+    sigaddset(&set, SIGIO);
+    sigaddset(&set, SIGRTMIN);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    wfd = open(DEV_NAME, O_WRONLY);
+    memset(&res, 0, sizeof(res));
+    res.lat = calloc(nr_stamps, sizeof(*res.lat));
+    if (wfd < 0 || !res.lat) {
+        printf("open %s failed\n", DEV_NAME);
+        return -1;
+    }
+
+    printf("%.1f MiB of 8-byte writes, bursts of %ld every %ld us\n", mib,
+        burst, interval_ns / 1000);
+    printf("%12s %10s %10s %10s %12s %12s %10s\n", "notify", "p50 us",
+        "p99 us", "max us", "signals/MiB", "syscall/MiB", "overflows");
+
+    for (mode = 0; mode < NR_MODES; mode++) {
+        rfd = open(DEV_NAME, O_RDONLY | O_NONBLOCK);
+        if (rfd < 0) {
+            printf("open %s failed\n", DEV_NAME);
+            break;
+        }
+        ioctl(rfd, GLOBALFIFO_IOC_CLEAR);
+        ioctl(rfd, GLOBALFIFO_IOC_COALESCE, mode == MODE_RT_COALESCE);
+
+        fcntl(rfd, F_SETOWN, getpid());
+        fcntl(rfd, F_SETSIG, mode == MODE_SIGIO ? 0 : SIGRTMIN);
+        fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) | FASYNC);
+
+        res.signals = res.overflows = res.syscalls = res.nr_lat = 0;
+        pthread_create(&tid, NULL, producer, &wfd);
+        consume(mode, rfd, &res);
+        pthread_join(tid, NULL);
+
+        fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) & ~FASYNC);
+        close(rfd);
+
+        /* drop whatever is still queued before the next run */
+        while (sigtimedwait(&set, NULL, &(struct timespec){ 0, 0 }) > 0)
+            ;
+
+        if (res.nr_lat == 0)
+            continue;
+        qsort(res.lat, res.nr_lat, sizeof(*res.lat), cmp_u64);
+        printf("%12s %10.1f %10.1f %10.1f %12.0f %12.0f %10ld\n",
+            mode_names[mode], res.lat[res.nr_lat / 2] / 1e3,
+            res.lat[res.nr_lat * 99 / 100] / 1e3,
+            res.lat[res.nr_lat - 1] / 1e3, res.signals / mib,
+            res.syscalls / mib, res.overflows);
+    }
+
+    ioctl(wfd, GLOBALFIFO_IOC_COALESCE, 0);
+    free(res.lat);
+    close(wfd);
+    return 0;
+}